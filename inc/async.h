@@ -0,0 +1,301 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "concurrent.h"
+
+namespace persist
+{
+
+// Wrapper which owns a Persist instance and commits saves on a dedicated
+// background thread. Submissions go into a single latest-wins slot: if a save
+// is submitted while another is still pending, the older data is discarded and
+// both submissions complete together when the newer data has been committed.
+//
+// The slot is guarded by a sequence counter, as in DeferredPersist, so Save()
+// takes no locks, never allocates and never waits for the writer thread. Each
+// submission is identified by a ticket, and completion is reported through an
+// atomic count of the submissions committed so far.
+//
+// Only Init(), Load(), Save(), Committed(), Wait() and stats() are provided.
+// Format(), Arm() and EmergencySave() would race with the writer thread.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
+class AsyncPersist
+{
+public:
+    struct Stats
+    {
+        uint32_t submitted;
+        uint32_t coalesced;
+        uint32_t committed;
+        uint32_t failed;
+        uint32_t queue_depth;
+        uint64_t last_latency_ns;
+        uint64_t max_latency_ns;
+        uint64_t total_latency_ns;
+    };
+
+    AsyncPersist(NVMem& nvmem) : persist_{nvmem} {}
+
+    ~AsyncPersist()
+    {
+        stop_.store(true, std::memory_order_release);
+        Wake();
+
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+    }
+
+    // Starts the writer thread on first call. Any saves submitted before this
+    // are held until the thread starts.
+    Result Init(void)
+    {
+        Result result = persist_.Init();
+
+        if (!thread_.joinable())
+        {
+            thread_ = std::thread{&AsyncPersist::Run, this};
+        }
+
+        return result;
+    }
+
+    // Returns the most recently committed data.
+    Result Load(TData& data) const
+    {
+        return persist_.Load(data);
+    }
+
+    // Copies `data` into the slot and returns a ticket identifying the
+    // submission. Performs no NVMem I/O, takes no locks and never waits: the
+    // writer thread is woken by notifying a condition variable without holding
+    // its mutex. Save() must not be called concurrently from multiple threads.
+    uint32_t Save(const TData& data)
+    {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        bool pending = (seq != taken_seq_.load(std::memory_order_acquire));
+
+        submitted_.fetch_add(1, std::memory_order_relaxed);
+
+        if (!pending)
+        {
+            first_submit_ns_ = Now();
+        }
+
+        Word words[kNumWords] = {};
+        std::memcpy(words, &data, sizeof(TData));
+        std::memcpy(&words[kDataWords], &first_submit_ns_, sizeof(uint64_t));
+
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (uint32_t i = 0; i < kNumWords; i++)
+        {
+            slot_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        seq_.store(seq + 2, std::memory_order_release);
+        Wake();
+        return seq + 2;
+    }
+
+    // Returns true once the data submitted with `ticket`, or data submitted
+    // after it, has been committed, successfully or not.
+    bool Committed(uint32_t ticket) const
+    {
+        return int32_t(done_seq_.load(std::memory_order_acquire) - ticket) >= 0;
+    }
+
+    // Blocks until Committed(ticket), then returns the result of the most
+    // recent commit. Not for use by real-time threads.
+    Result Wait(uint32_t ticket)
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        done_cv_.wait(lock, [this, ticket]{ return Committed(ticket); });
+        return Result(result_.load(std::memory_order_relaxed));
+    }
+
+    Stats stats(void) const
+    {
+        Stats stats;
+        stats.submitted = submitted_.load(std::memory_order_relaxed);
+        stats.coalesced = coalesced_.load(std::memory_order_relaxed);
+        stats.committed = committed_.load(std::memory_order_relaxed);
+        stats.failed = failed_.load(std::memory_order_relaxed);
+        stats.queue_depth = (seq_.load(std::memory_order_relaxed) !=
+            taken_seq_.load(std::memory_order_relaxed)) ? 1 : 0;
+        stats.last_latency_ns =
+            last_latency_ns_.load(std::memory_order_relaxed);
+        stats.max_latency_ns = max_latency_ns_.load(std::memory_order_relaxed);
+        stats.total_latency_ns =
+            total_latency_ns_.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+protected:
+    using Clock = std::chrono::steady_clock;
+    using Word = uintptr_t;
+
+    // The slot holds the data followed by the time of the first submission
+    // since the slot was last taken, from which commit latency is measured.
+    static constexpr uint32_t kDataWords =
+        (sizeof(TData) + sizeof(Word) - 1) / sizeof(Word);
+    static constexpr uint32_t kNumWords =
+        kDataWords + (sizeof(uint64_t) + sizeof(Word) - 1) / sizeof(Word);
+
+    // A wakeup lost because the writer thread was about to wait when it was
+    // notified delays the commit by at most this long.
+    static constexpr std::chrono::milliseconds kWakeInterval{10};
+
+    ConcurrentPersist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality> persist_;
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+
+    // Written only by Save().
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<Word> slot_[kNumWords] = {};
+    uint64_t first_submit_ns_ = 0;
+
+    // Written only by the writer thread.
+    std::atomic<uint32_t> taken_seq_{0};
+    std::atomic<uint32_t> done_seq_{0};
+    std::atomic<int> result_{RESULT_SUCCESS};
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable done_cv_;
+
+    std::atomic<uint32_t> submitted_{0};
+    std::atomic<uint32_t> coalesced_{0};
+    std::atomic<uint32_t> committed_{0};
+    std::atomic<uint32_t> failed_{0};
+    std::atomic<uint64_t> last_latency_ns_{0};
+    std::atomic<uint64_t> max_latency_ns_{0};
+    std::atomic<uint64_t> total_latency_ns_{0};
+
+    static uint64_t Now(void)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch()).count();
+    }
+
+    void Wake(void)
+    {
+        cv_.notify_one();
+    }
+
+    bool SavePending(void) const
+    {
+        return seq_.load(std::memory_order_acquire) !=
+            taken_seq_.load(std::memory_order_relaxed);
+    }
+
+    // Copies the most recent submission out of the slot, retrying if it is
+    // replaced meanwhile, and marks it taken. Each submission advances the
+    // sequence counter by two, so any others since the last taken were
+    // coalesced.
+    uint32_t Take(TData& data, uint64_t& submit_ns)
+    {
+        Word words[kNumWords];
+        uint32_t seq;
+
+        do
+        {
+            while ((seq = seq_.load(std::memory_order_acquire)) & 1);
+
+            for (uint32_t i = 0; i < kNumWords; i++)
+            {
+                words[i] = slot_[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        while (seq != seq_.load(std::memory_order_relaxed));
+
+        std::memcpy(&data, words, sizeof(TData));
+        std::memcpy(&submit_ns, &words[kDataWords], sizeof(uint64_t));
+        uint32_t taken = (seq - taken_seq_.load(std::memory_order_relaxed)) / 2;
+        coalesced_.fetch_add(taken - 1, std::memory_order_relaxed);
+        taken_seq_.store(seq, std::memory_order_release);
+        return seq;
+    }
+
+    void Run(void)
+    {
+        for (;;)
+        {
+            if (!SavePending())
+            {
+                if (stop_.load(std::memory_order_acquire))
+                {
+                    break;
+                }
+
+                std::unique_lock<std::mutex> lock{mutex_};
+                cv_.wait_for(lock, kWakeInterval, [this]{
+                    return SavePending() ||
+                        stop_.load(std::memory_order_acquire); });
+                continue;
+            }
+
+            TData data;
+            uint64_t submit_ns;
+            uint32_t seq = Take(data, submit_ns);
+            Result result = persist_.Save(data);
+            uint64_t latency = Now() - submit_ns;
+
+            committed_.fetch_add(1, std::memory_order_relaxed);
+            failed_.fetch_add(result != RESULT_SUCCESS,
+                std::memory_order_relaxed);
+            last_latency_ns_.store(latency, std::memory_order_relaxed);
+            max_latency_ns_.store(std::max(latency,
+                max_latency_ns_.load(std::memory_order_relaxed)),
+                std::memory_order_relaxed);
+            total_latency_ns_.fetch_add(latency, std::memory_order_relaxed);
+
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                result_.store(result, std::memory_order_relaxed);
+                done_seq_.store(seq, std::memory_order_release);
+            }
+
+            done_cv_.notify_all();
+        }
+    }
+};
+
+}
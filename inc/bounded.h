@@ -0,0 +1,270 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Persist with bounded worst-case latency. Each call to Save() or Maintain()
+// performs at most one block write or one erase of a single erase granule, in
+// addition to reads. Pages are erased one granule at a time, and blocks are
+// written strictly in order, so that a page is never written until all of its
+// granules have been erased. The memory itself records the progress of an
+// erase: after a restart, granules which are already blank are skipped.
+//
+// Calling Maintain() regularly erases the next page ahead of time, so that
+// Save() need never erase. If the next page is not ready when Save() needs it,
+// Save() erases one granule and returns RESULT_BUSY without saving; the caller
+// should call Save() again later. Save() also returns RESULT_BUSY while an
+// erase it issued earlier is still running in the background, since a granule
+// being erased is never read.
+//
+// The latency bound does not hold for Init(), or the rare full rescan
+// performed when a failed write is followed by a failure to verify the
+// previously saved block. Arm() and EmergencySave() are not available.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
+class BoundedPersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer, Layout, Equality>
+{
+public:
+    BoundedPersist(NVMem& nvmem) : Base{nvmem} {}
+
+    Result Init(void)
+    {
+        erase_page_ = -1;
+        erase_pending_ = false;
+        return Base::Init();
+    }
+
+    Result Save(const TData& data)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_SAVE, 0, sizeof(TData));
+        this->stats_.SaveRequested();
+        Result result = RESULT_SUCCESS;
+
+        if (this->DataIsSame(data))
+        {
+            this->stats_.SaveSuppressed();
+        }
+        else
+        {
+            result = WriteBlock(data);
+        }
+
+        this->tracer_.End(TRACE_SAVE, result == RESULT_SUCCESS);
+        this->stats_.SaveDone(start);
+        return result;
+    }
+
+    // Erases one granule of the page following the current page, unless that
+    // page is already erased or holds the most recently saved block.
+    Result Maintain(void)
+    {
+        uint32_t page = (this->head_block_n_ == -1) ? 0 :
+            (PageOf(this->head_block_n_) + 1) % Base::kNumPages;
+
+        if (this->active_block_n_ != -1 &&
+            page == PageOf(this->active_block_n_))
+        {
+            return RESULT_SUCCESS;
+        }
+
+        return PageErased(page) ? RESULT_SUCCESS : EraseStep(page);
+    }
+
+    Result Arm(uint32_t stable_size = 0) = delete;
+    Result EmergencySave(const TData& data) = delete;
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality>;
+    using TSequenceNum = typename Base::TSequenceNum;
+
+    static constexpr uint32_t kGranuleSize = NVMem::kEraseGranularity;
+
+    // The page holding the newest block is never erased, so a single page
+    // could never be reused.
+    static_assert(Base::kNumPages >= 2,
+        "BoundedPersist requires at least two pages");
+    static constexpr uint32_t kGranulesPerPage = Base::kPageSize / kGranuleSize;
+
+    // Page currently being erased, and the number of its leading granules
+    // known to be erased. If erase_pending_ is set, the erase of the next
+    // granule has been issued but may still be running in the background.
+    int32_t erase_page_ = -1;
+    uint32_t erase_granule_;
+    bool erase_pending_ = false;
+
+    static uint32_t PageOf(int32_t block_n)
+    {
+        return block_n / Base::kBlocksPerPage;
+    }
+
+    Result WriteBlock(const TData& data)
+    {
+        int32_t block_n = this->head_block_n_;
+
+        // Skip blocks in the current page which can't be written, e.g. due to
+        // earlier failed writes. Entering a new page requires it to be erased.
+        do
+        {
+            block_n = (block_n + 1) % Base::kNumBlocks;
+
+            if (block_n % Base::kBlocksPerPage == 0)
+            {
+                uint32_t page = PageOf(block_n);
+
+                if (!PageErased(page))
+                {
+                    Result result = EraseStep(page);
+                    return (result == RESULT_SUCCESS) ? RESULT_BUSY : result;
+                }
+
+                // The page is about to be written, so must be checked again
+                // before it is next entered.
+                erase_page_ = -1;
+            }
+        }
+        while (!this->MemWritable(this->BlockLocation(block_n),
+            Base::kBlockSize));
+
+        int32_t previous_block_n = this->active_block_n_;
+        TSequenceNum previous_sequence = this->sequence_;
+        TSequenceNum sequence = (previous_block_n == -1) ? 0 :
+            TSequenceNum(previous_sequence + 1);
+        this->armed_block_n_ = -1;
+
+        Equality::Store(this->block_.data, data);
+        std::memset(&this->block_.padding, NVMem::kFillByte,
+            Base::kBlockPaddingSize);
+        this->block_.sequence_n = sequence;
+        this->block_.crc = this->GetCRC(this->block_);
+
+        return this->ProgramBlock(block_n, sequence, previous_block_n,
+            previous_sequence);
+    }
+
+    // Returns true if every granule of `page` is erased, checking only the
+    // granules not already known to be erased. A granule whose erase is still
+    // running is not read, as NVMem requires, and the page is not yet erased.
+    bool PageErased(uint32_t page)
+    {
+        if (erase_page_ != int32_t(page))
+        {
+            if (erase_pending_ && EraseRunning())
+            {
+                return false;
+            }
+
+            erase_page_ = page;
+            erase_granule_ = 0;
+            erase_pending_ = false;
+        }
+
+        if (erase_pending_)
+        {
+            if (EraseRunning())
+            {
+                return false;
+            }
+
+            erase_pending_ = false;
+            erase_granule_++;
+
+            if (erase_granule_ == kGranulesPerPage)
+            {
+                this->stats_.PageErased(page);
+            }
+        }
+
+        while (erase_granule_ < kGranulesPerPage)
+        {
+            uint32_t location =
+                page * Base::kPageSize + erase_granule_ * kGranuleSize;
+
+            if (!this->MemWritable(location, kGranuleSize))
+            {
+                return false;
+            }
+
+            erase_granule_++;
+        }
+
+        return true;
+    }
+
+    // Erases the first granule of `page` not known to be erased, unless an
+    // erase is still running. Must follow a call to PageErased(page) which
+    // returned false.
+    Result EraseStep(uint32_t page)
+    {
+        if (erase_pending_)
+        {
+            return RESULT_SUCCESS;
+        }
+
+        if (this->active_block_n_ != -1 &&
+            page == PageOf(this->active_block_n_))
+        {
+            return RESULT_FAIL_ERASE;
+        }
+
+        uint32_t location =
+            page * Base::kPageSize + erase_granule_ * kGranuleSize;
+
+        if (erase_granule_ == 0)
+        {
+            this->tracer_.Mark(TRACE_PAGE_ROLLOVER, page);
+        }
+
+        if (!this->EraseMem(location, kGranuleSize))
+        {
+            return RESULT_FAIL_ERASE;
+        }
+
+        // The granule is counted as erased by PageErased() once the erase has
+        // finished.
+        erase_pending_ = true;
+        return RESULT_SUCCESS;
+    }
+
+    // True if an erase started by EraseStep() may still be running. Only an
+    // NVMem which can suspend erases lets reads overlap one; otherwise every
+    // read waits for it to finish, so it is complete by the time it matters.
+    bool EraseRunning(void)
+    {
+        bool suspended = this->SuspendErase();
+        this->ResumeErase(suspended);
+        return suspended;
+    }
+};
+
+}
@@ -0,0 +1,249 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Latencies of loads by ConcurrentPersist readers, which can't update the
+// recorder since it is guarded by the mutex. Merged into a copy of the
+// recorder's statistics on request.
+template <typename Recorder, bool = Recorder::kEnabled>
+struct ReaderLoadStats
+{
+    void Add(uint32_t) {}
+    void MergeInto(Recorder&) const {}
+};
+
+template <typename Recorder>
+struct ReaderLoadStats<Recorder, true>
+{
+    using Histogram = decltype(Recorder::load_latency);
+
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> max{0};
+    std::atomic<uint32_t> buckets[Histogram::kNumBuckets] = {};
+
+    void Add(uint32_t latency)
+    {
+        count.fetch_add(1, std::memory_order_relaxed);
+        buckets[Histogram::Bucket(latency)].fetch_add(1,
+            std::memory_order_relaxed);
+        uint32_t old_max = max.load(std::memory_order_relaxed);
+
+        while (latency > old_max && !max.compare_exchange_weak(old_max,
+            latency, std::memory_order_relaxed));
+    }
+
+    void MergeInto(Recorder& recorder) const
+    {
+        Histogram& histogram = recorder.load_latency;
+        histogram.count += count.load(std::memory_order_relaxed);
+        uint32_t reader_max = max.load(std::memory_order_relaxed);
+        histogram.max = std::max(histogram.max, reader_max);
+
+        for (uint32_t i = 0; i < Histogram::kNumBuckets; i++)
+        {
+            uint32_t total = histogram.buckets[i] +
+                buckets[i].load(std::memory_order_relaxed);
+            histogram.buckets[i] = std::min<uint32_t>(total, UINT16_MAX);
+        }
+    }
+};
+
+// Thread-safe wrapper around Persist for hosted environments. Saves are
+// serialized by a mutex, while loads are served from a cached copy of the
+// active data protected by a sequence lock, so readers never block on NVMem
+// I/O or on each other. Loads are lock-free but not wait-free: a reader which
+// overlaps the publication of a save retries, so one may retry for as long as
+// saves keep completing.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
+class ConcurrentPersist
+{
+public:
+    ConcurrentPersist(NVMem& nvmem) : persist_{nvmem} {}
+
+    Result Init(void)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        Result result = persist_.Init();
+        Publish();
+        return result;
+    }
+
+    Result Load(TData& data) const
+    {
+        uint32_t start = StatsRecorder::Now();
+        Word words[kNumWords];
+        bool valid;
+        uint32_t seq;
+
+        do
+        {
+            while ((seq = seq_.load(std::memory_order_acquire)) & 1);
+
+            valid = valid_.load(std::memory_order_relaxed);
+
+            for (uint32_t i = 0; i < kNumWords; i++)
+            {
+                words[i] = image_[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        while (seq != seq_.load(std::memory_order_relaxed));
+
+        if (valid)
+        {
+            std::memcpy(&data, words, sizeof(TData));
+        }
+
+        reader_loads_.Add(StatsRecorder::Now() - start);
+        return valid ? RESULT_SUCCESS : RESULT_FAIL_NO_DATA;
+    }
+
+    Result Save(const TData& data)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        Result result = persist_.Save(data);
+        Publish();
+        return result;
+    }
+
+    Result Format(void)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        Result result = persist_.Format();
+        Publish();
+        return result;
+    }
+
+    Result Arm(uint32_t stable_size = 0)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return persist_.Arm(stable_size);
+    }
+
+    bool armed(void)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return persist_.armed();
+    }
+
+    // Waits for any save in progress, so is bounded only if none is.
+    Result EmergencySave(const TData& data)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        Result result = persist_.EmergencySave(data);
+        Publish();
+        return result;
+    }
+
+    // Returns a copy of the statistics, including loads by readers. See
+    // inc/stats.h.
+    auto stats(void)
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        StatsRecorder stats = persist_.stats();
+        lock.unlock();
+        reader_loads_.MergeInto(stats);
+        return stats;
+    }
+
+    template <typename... Legacy>
+    Result LoadLegacy(TData& data)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return persist_.template LoadLegacy<Legacy...>(data);
+    }
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality>;
+    using StatsRecorder = std::remove_cv_t<std::remove_reference_t<
+        decltype(std::declval<Base&>().stats())>>;
+    using Word = uintptr_t;
+    static constexpr uint32_t kNumWords =
+        (sizeof(TData) + sizeof(Word) - 1) / sizeof(Word);
+
+    // Persist whose active data can be read without counting as a load.
+    class Inner : public Base
+    {
+    public:
+        using Base::Base;
+
+        bool ReadActive(TData& data) const
+        {
+            if (this->active_block_n_ == -1)
+            {
+                return false;
+            }
+
+            std::memcpy(&data, &this->block_.data, sizeof(TData));
+            return true;
+        }
+    };
+
+    Inner persist_;
+    std::mutex mutex_;
+    mutable ReaderLoadStats<StatsRecorder> reader_loads_;
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<bool> valid_{false};
+    std::atomic<Word> image_[kNumWords] = {};
+
+    // Must be called with mutex_ held.
+    void Publish(void)
+    {
+        TData data{};
+        Word words[kNumWords] = {};
+        bool valid = persist_.ReadActive(data);
+        std::memcpy(words, &data, sizeof(TData));
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        valid_.store(valid, std::memory_order_relaxed);
+
+        for (uint32_t i = 0; i < kNumWords; i++)
+        {
+            image_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+};
+
+}
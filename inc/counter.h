@@ -0,0 +1,321 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "crc16.h"
+#include "nvmem_traits.h"
+#include "../persist.h"
+
+namespace persist
+{
+
+// Monotonic counter, e.g. of operating hours or cycles, which records most
+// increments without erasing. Each page begins with a header holding a base
+// value, and the rest of the page is a unary area whose slots are programmed
+// in order, one per increment. The value is the base of the newest page plus
+// the number of programmed slots. When the area is full, the next page is
+// erased and given the current value as its base.
+//
+// If NVMem::kSupportsReprogram is true, each slot is a single bit, which is
+// programmed by writing its unit again. Otherwise each slot is a whole unit of
+// kWriteGranularity bytes. For example, a 4 KiB page of byte-writable NOR flash
+// holds over 32000 increments per erase, where Persist would write a new
+// block for each.
+//
+// An increment interrupted by a loss of power either takes effect or doesn't.
+// An Increment() by more than one may take partial effect.
+template <typename NVMem, uint8_t datatype_version,
+    bool assert_fault_tolerant = true>
+class UnaryCounter
+{
+public:
+    UnaryCounter(NVMem& nvmem) : nvmem_{nvmem} {}
+
+    // Finds the newest page and counts its programmed slots.
+    Result Init(void)
+    {
+        crc_.Init();
+        page_n_ = -1;
+        base_ = 0;
+        sequence_ = 0;
+        slots_used_ = 0;
+        slots_counted_ = 0;
+
+        for (uint32_t i = 0; i < kNumPages; i++)
+        {
+            Header header;
+
+            if (!nvmem_.Read(&header, i * kPageSize, sizeof(header)))
+            {
+                page_n_ = -1;
+                return RESULT_FAIL_READ;
+            }
+
+            if (header.crc == GetCRC(header) &&
+                (page_n_ == -1 || IsNewer(header.sequence_n, sequence_)))
+            {
+                page_n_ = i;
+                base_ = header.base;
+                sequence_ = header.sequence_n;
+            }
+        }
+
+        return (page_n_ == -1) ? RESULT_SUCCESS : CountSlots();
+    }
+
+    uint64_t value(void) const
+    {
+        return base_ + slots_counted_;
+    }
+
+    // Adds `n` to the counter, programming `n` slots if they fit in the current
+    // page, or otherwise starting a new page.
+    Result Increment(uint32_t n = 1)
+    {
+        if (n == 0)
+        {
+            return RESULT_SUCCESS;
+        }
+
+        if (page_n_ == -1 || n > kSlotsPerPage - slots_used_)
+        {
+            return StartPage(value() + n);
+        }
+
+        uint32_t first = slots_used_ / kSlotsPerUnit;
+        uint32_t last = (slots_used_ + n - 1) / kSlotsPerUnit;
+        uint32_t location = UnitLocation(first);
+        slots_used_ += n;
+
+        while (first <= last)
+        {
+            uint32_t num_units = std::min(last - first + 1, kBufferUnits);
+            uint8_t buffer[kBufferUnits * kUnitSize];
+            std::memset(buffer, NVMem::kFillByte, sizeof(buffer));
+
+            for (uint32_t i = 0; i < num_units * kUnitSize * 8; i++)
+            {
+                uint32_t slot = first * kSlotsPerUnit +
+                    i / (kUnitSize * 8 / kSlotsPerUnit);
+
+                if (slot >= slots_used_ - n && slot < slots_used_)
+                {
+                    buffer[i / 8] ^= 1 << (i % 8);
+                }
+            }
+
+            if (!nvmem_.Write(location, buffer, num_units * kUnitSize))
+            {
+                // The slots remain used. Any which were programmed nonetheless
+                // are counted after the next Init().
+                return RESULT_FAIL_WRITE;
+            }
+
+            first += num_units;
+            location += num_units * kUnitSize;
+        }
+
+        slots_counted_ += n;
+        return RESULT_SUCCESS;
+    }
+
+    // Number of increments by one recorded per page erase.
+    static constexpr uint32_t GetIncrementsPerErase(void)
+    {
+        return kSlotsPerPage;
+    }
+
+protected:
+    static constexpr uint32_t kUnitSize = NVMem::kWriteGranularity;
+    static constexpr uint32_t kHeaderPaddingSize =
+        (kUnitSize - (sizeof(uint64_t) + 2 * sizeof(uint16_t)) % kUnitSize) %
+        kUnitSize;
+
+    struct __attribute__ ((packed)) Header
+    {
+        uint64_t base;
+        uint16_t sequence_n;
+        uint16_t crc;
+        uint8_t padding[kHeaderPaddingSize];
+    };
+
+    static constexpr bool kBitSlots = SupportsReprogram<NVMem>::value;
+    static constexpr uint32_t kSlotsPerUnit = kBitSlots ? kUnitSize * 8 : 1;
+    static constexpr uint32_t kPageSize = NVMem::kEraseGranularity *
+        ((sizeof(Header) + kUnitSize + NVMem::kEraseGranularity - 1) /
+        NVMem::kEraseGranularity);
+    static constexpr uint32_t kUnitsPerPage =
+        (kPageSize - sizeof(Header)) / kUnitSize;
+    static constexpr uint32_t kSlotsPerPage = kUnitsPerPage * kSlotsPerUnit;
+    static constexpr uint32_t kNumPages = NVMem::kSize / kPageSize;
+    static constexpr uint32_t kBufferUnits =
+        std::max<uint32_t>(1, 64 / kUnitSize);
+
+    static_assert(kNumPages > 0);
+    static_assert(kNumPages <= 0x8000);
+    static_assert(assert_fault_tolerant == false || kNumPages >= 2,
+        "Region is not fault-tolerant");
+
+    NVMem& nvmem_;
+    Crc16 crc_;
+    int32_t page_n_;
+    uint64_t base_;
+    uint16_t sequence_;
+
+    // Slots in the current page which are used, including any which were only
+    // partly programmed, and those which count towards the value.
+    uint32_t slots_used_;
+    uint32_t slots_counted_;
+
+    static bool IsNewer(uint16_t sn, uint16_t than)
+    {
+        return uint16_t(sn - than) < 0x8000;
+    }
+
+    uint16_t GetCRC(const Header& header)
+    {
+        uint16_t seed = datatype_version;
+        crc_.Seed(~(seed | (~seed << 8)));
+        return crc_.Process(&header, offsetof(Header, crc));
+    }
+
+    uint32_t UnitLocation(uint32_t unit_n) const
+    {
+        return page_n_ * kPageSize + sizeof(Header) + unit_n * kUnitSize;
+    }
+
+    // Counts the programmed slots of the current page, which end at the first
+    // blank unit.
+    Result CountSlots(void)
+    {
+        slots_used_ = 0;
+        slots_counted_ = 0;
+
+        for (uint32_t unit_n = 0; unit_n < kUnitsPerPage; )
+        {
+            uint8_t buffer[kBufferUnits * kUnitSize];
+            uint32_t num_units = std::min(kUnitsPerPage - unit_n, kBufferUnits);
+
+            if (!nvmem_.Read(buffer, UnitLocation(unit_n),
+                num_units * kUnitSize))
+            {
+                page_n_ = -1;
+                return RESULT_FAIL_READ;
+            }
+
+            for (uint32_t i = 0; i < num_units; i++, unit_n++)
+            {
+                const uint8_t* unit = &buffer[i * kUnitSize];
+                uint32_t programmed = 0;
+
+                for (uint32_t j = 0; j < kUnitSize; j++)
+                {
+                    programmed += Popcount(unit[j] ^ NVMem::kFillByte);
+                }
+
+                if (programmed == 0)
+                {
+                    return RESULT_SUCCESS;
+                }
+
+                if (kBitSlots)
+                {
+                    // Bits are programmed in order, so the last one marks the
+                    // end of the used slots.
+                    slots_used_ = unit_n * kSlotsPerUnit + LastSlot(unit);
+                    slots_counted_ += programmed;
+                }
+                else
+                {
+                    slots_used_ = unit_n + 1;
+                    slots_counted_ += (programmed == kUnitSize * 8);
+                }
+            }
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    static uint32_t Popcount(uint8_t x)
+    {
+        uint32_t count = 0;
+
+        for (; x; x &= x - 1)
+        {
+            count++;
+        }
+
+        return count;
+    }
+
+    // Returns one more than the index of the last programmed bit of `unit`.
+    static uint32_t LastSlot(const uint8_t* unit)
+    {
+        for (uint32_t i = kUnitSize * 8; i > 0; i--)
+        {
+            if ((unit[(i - 1) / 8] ^ NVMem::kFillByte) & (1 << ((i - 1) % 8)))
+            {
+                return i;
+            }
+        }
+
+        return 0;
+    }
+
+    // Erases the page following the current one and writes a header with the
+    // given base value.
+    Result StartPage(uint64_t base)
+    {
+        uint32_t page_n = (page_n_ == -1) ? 0 : (page_n_ + 1) % kNumPages;
+        uint16_t sequence = (page_n_ == -1) ? 0 : uint16_t(sequence_ + 1);
+
+        if (!nvmem_.Erase(page_n * kPageSize, kPageSize))
+        {
+            return RESULT_FAIL_ERASE;
+        }
+
+        Header header;
+        std::memset(&header, NVMem::kFillByte, sizeof(header));
+        header.base = base;
+        header.sequence_n = sequence;
+        header.crc = GetCRC(header);
+
+        if (!nvmem_.Write(page_n * kPageSize, &header, sizeof(header)))
+        {
+            return RESULT_FAIL_WRITE;
+        }
+
+        page_n_ = page_n;
+        base_ = base;
+        sequence_ = sequence;
+        slots_used_ = 0;
+        slots_counted_ = 0;
+        return RESULT_SUCCESS;
+    }
+};
+
+}
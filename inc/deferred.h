@@ -0,0 +1,129 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Persist with an additional save path which may be used from interrupt
+// handlers. RequestSave() publishes a snapshot of the data into a preallocated
+// slot, and Commit() later saves the most recently published snapshot from
+// thread context.
+//
+// The slot is guarded by a sequence counter with a single writer, so only
+// atomic loads and stores of 32-bit words are needed. These are lock-free on
+// every Cortex-M core, including those without exclusive access instructions.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
+class DeferredPersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer, Layout, Equality>
+{
+public:
+    DeferredPersist(NVMem& nvmem) : Base{nvmem} {}
+
+    // Safe to call from an interrupt handler. Performs no NVMem I/O, takes no
+    // locks and never waits: the cost is one load, kNumWords + 2 stores and two
+    // memory barriers. RequestSave() must not be called reentrantly, i.e. from
+    // more than one interrupt priority level, or concurrently from multiple
+    // threads.
+    void RequestSave(const TData& data)
+    {
+        uint32_t words[kNumWords] = {};
+        std::memcpy(words, &data, sizeof(TData));
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (uint32_t i = 0; i < kNumWords; i++)
+        {
+            slot_[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    // Returns true if a snapshot has been requested but not yet committed.
+    bool SavePending(void) const
+    {
+        return seq_.load(std::memory_order_acquire) != committed_seq_;
+    }
+
+    // Must be called from thread context. Saves the most recently requested
+    // snapshot, if any. If the snapshot is replaced while it is being copied
+    // out of the slot, the copy is retried. On failure the request remains
+    // pending so that it may be retried by a later call.
+    Result Commit(void)
+    {
+        uint32_t words[kNumWords];
+        uint32_t seq;
+
+        do
+        {
+            while ((seq = seq_.load(std::memory_order_acquire)) & 1);
+
+            if (seq == committed_seq_)
+            {
+                return RESULT_SUCCESS;
+            }
+
+            for (uint32_t i = 0; i < kNumWords; i++)
+            {
+                words[i] = slot_[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        while (seq != seq_.load(std::memory_order_relaxed));
+
+        TData data;
+        std::memcpy(&data, words, sizeof(TData));
+        Result result = Base::Save(data);
+
+        if (result == RESULT_SUCCESS)
+        {
+            committed_seq_ = seq;
+        }
+
+        return result;
+    }
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality>;
+    static constexpr uint32_t kNumWords =
+        (sizeof(TData) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint32_t> slot_[kNumWords] = {};
+    uint32_t committed_seq_ = 0;
+};
+
+}
@@ -0,0 +1,103 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace persist
+{
+
+// Equality policies decide whether Data passed to Save() differs from the
+// saved image of the Data, in which case a new Block is written, and fill in
+// the image to be written. Each provides:
+//
+// - Same(image, data): true if `data` need not be saved over `image`
+// - Store(image, data): copies `data` into `image`, which has sizeof(TData)
+//   bytes
+//
+// The policy doesn't affect the format of the memory region, so it may be
+// changed without losing the saved data.
+
+// Compares every byte, including any padding. This is the default.
+struct BytewiseEqual
+{
+    template <typename TData>
+    static bool Same(const uint8_t* image, const TData& data)
+    {
+        return 0 == std::memcmp(image, &data, sizeof(TData));
+    }
+
+    template <typename TData>
+    static void Store(uint8_t* image, const TData& data)
+    {
+        std::memcpy(image, &data, sizeof(TData));
+    }
+};
+
+// Compares with TData's operator==, e.g. to disregard padding bytes with
+// indeterminate values.
+struct MemberwiseEqual : BytewiseEqual
+{
+    template <typename TData>
+    static bool Same(const uint8_t* image, const TData& data)
+    {
+        TData saved;
+        std::memcpy(&saved, image, sizeof(TData));
+        return saved == data;
+    }
+};
+
+// Compares every byte except those of the given data members, e.g.
+// `IgnoreFields<&MyData::last_seen>`. Changes to them alone are not saved, but
+// their latest values are saved along with any other change.
+template <auto... members>
+struct IgnoreFields : BytewiseEqual
+{
+    template <typename TData>
+    static bool Same(const uint8_t* image, const TData& data)
+    {
+        TData saved;
+        std::memcpy(&saved, image, sizeof(TData));
+        (std::memcpy(&(saved.*members), &(data.*members),
+            sizeof(data.*members)), ...);
+        return 0 == std::memcmp(&saved, &data, sizeof(TData));
+    }
+};
+
+// As IgnoreFields, but the given data members are never saved: they are zeroed
+// in the image, and so read as zero by Load().
+template <auto... members>
+struct ExcludeFields : IgnoreFields<members...>
+{
+    template <typename TData>
+    static void Store(uint8_t* image, const TData& data)
+    {
+        std::memcpy(image, &data, sizeof(TData));
+        auto base = reinterpret_cast<const uint8_t*>(&data);
+        (std::memset(image + (reinterpret_cast<const uint8_t*>(
+            &(data.*members)) - base), 0, sizeof(data.*members)), ...);
+    }
+};
+
+}
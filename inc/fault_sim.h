@@ -0,0 +1,356 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <thread>
+#include <vector>
+#include "../persist.h"
+#include "sim_nvmem.h"
+
+namespace persist
+{
+
+// SimNVMem which can lose power partway through a write or erase. After
+// CutPowerAfter(n), the next n bytes of writes and erases complete normally;
+// the operation during which the budget runs out is applied only to its first
+// bytes, and it and every subsequent operation fail until RestorePower().
+template <uint32_t size, uint32_t erase_granularity, uint32_t write_granularity,
+    uint8_t fill_byte = 0xFF, bool supports_reprogram = false>
+class FaultNVMem : public SimNVMem<size, erase_granularity, write_granularity,
+    fill_byte, supports_reprogram>
+{
+public:
+    void CutPowerAfter(uint64_t num_bytes)
+    {
+        budget_ = num_bytes;
+    }
+
+    void RestorePower(void)
+    {
+        budget_ = kUnlimited;
+        powered_ = true;
+    }
+
+    bool powered(void) const
+    {
+        return powered_;
+    }
+
+    bool Read(void* dst, uint32_t location, uint32_t length)
+    {
+        return powered_ && Base::Read(dst, location, length);
+    }
+
+    bool Writable(uint32_t location, uint32_t length)
+    {
+        return powered_ && Base::Writable(location, length);
+    }
+
+    bool Write(uint32_t location, const void* src, uint32_t length)
+    {
+        if (!powered_)
+        {
+            return false;
+        }
+
+        if (length <= budget_)
+        {
+            Consume(length);
+            return Base::Write(location, src, length);
+        }
+
+        auto byte = reinterpret_cast<const uint8_t*>(src);
+
+        for (uint32_t i = 0;
+            i < budget_ && Base::InBounds(location + i, 1); i++)
+        {
+            this->mem_[location + i] =
+                Base::Program(this->mem_[location + i], byte[i]);
+        }
+
+        powered_ = false;
+        return false;
+    }
+
+    bool Erase(uint32_t location, uint32_t length)
+    {
+        if (!powered_)
+        {
+            return false;
+        }
+
+        if (length <= budget_)
+        {
+            Consume(length);
+            return Base::Erase(location, length);
+        }
+
+        if (Base::InBounds(location, budget_))
+        {
+            std::memset(&this->mem_[location], fill_byte, budget_);
+        }
+
+        powered_ = false;
+        return false;
+    }
+
+protected:
+    using Base = SimNVMem<size, erase_granularity, write_granularity,
+        fill_byte, supports_reprogram>;
+    static constexpr uint64_t kUnlimited = std::numeric_limits<uint64_t>::max();
+
+    uint64_t budget_ = kUnlimited;
+    bool powered_ = true;
+
+    void Consume(uint32_t length)
+    {
+        if (budget_ != kUnlimited)
+        {
+            budget_ -= length;
+        }
+    }
+};
+
+// Verifies the fault tolerance of Persist by cutting power at every byte of
+// every write and erase performed by a sequence of saves. For each save and
+// cut point, the memory is restored to its state before the save, the save is
+// interrupted, and after remounting, Load() must return either the data from
+// before the save or the data being saved. A further save and remount must then
+// succeed. The time taken by each remount is recorded.
+//
+// NVMem must be a FaultNVMem. TPersist may be any Persist variant with the
+// same interface; saves which return RESULT_BUSY are repeated.
+template <typename NVMem, typename TData,
+    typename TPersist = Persist<NVMem, TData, 0>>
+class PowerLossHarness
+{
+public:
+    struct Report
+    {
+        uint64_t cases;
+        uint64_t failures;
+
+        // The first failing case, if any.
+        uint32_t failed_save;
+        uint64_t failed_cut;
+
+        // Sorted durations of every remount after a fault, in nanoseconds.
+        std::vector<uint64_t> mount_ns;
+
+        uint64_t MountPercentile(double percentile) const
+        {
+            if (mount_ns.empty())
+            {
+                return 0;
+            }
+
+            size_t i = percentile / 100 * (mount_ns.size() - 1) + 0.5;
+            return mount_ns[std::min(i, mount_ns.size() - 1)];
+        }
+    };
+
+    // Tests every cut point of each of `num_saves` consecutive saves, starting
+    // from erased memory. The saves are divided among `num_threads` threads.
+    Report Run(uint32_t num_saves,
+        uint32_t num_threads = std::thread::hardware_concurrency())
+    {
+        num_threads = std::max<uint32_t>(num_threads, 1);
+        std::vector<Report> reports(num_threads);
+        std::vector<std::thread> threads;
+
+        for (uint32_t t = 0; t < num_threads; t++)
+        {
+            threads.emplace_back([&, t](void)
+            {
+                reports[t] = RunPartition(num_saves, t, num_threads);
+            });
+        }
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        Report report{};
+        report.failed_save = std::numeric_limits<uint32_t>::max();
+
+        for (Report& r : reports)
+        {
+            report.cases += r.cases;
+            report.failures += r.failures;
+
+            if (r.failures && r.failed_save < report.failed_save)
+            {
+                report.failed_save = r.failed_save;
+                report.failed_cut = r.failed_cut;
+            }
+
+            report.mount_ns.insert(report.mount_ns.end(), r.mount_ns.begin(),
+                r.mount_ns.end());
+        }
+
+        std::sort(report.mount_ns.begin(), report.mount_ns.end());
+        return report;
+    }
+
+    // Produces distinct data for each save.
+    static TData MakeData(uint64_t n)
+    {
+        uint8_t bytes[sizeof(TData)];
+        uint64_t x = (n + 1) * 0x9E3779B97F4A7C15;
+
+        for (uint32_t i = 0; i < sizeof(TData); i++)
+        {
+            bytes[i] = uint8_t(x >> (8 * (i % 8))) ^ uint8_t(i);
+        }
+
+        TData data;
+        std::memcpy(&data, bytes, sizeof(TData));
+        return data;
+    }
+
+protected:
+    using Clock = std::chrono::steady_clock;
+
+    static bool Equal(const TData& a, const TData& b)
+    {
+        return 0 == std::memcmp(&a, &b, sizeof(TData));
+    }
+
+    static Result Save(TPersist& persist, const TData& data)
+    {
+        Result result;
+
+        do
+        {
+            result = persist.Save(data);
+        }
+        while (result == RESULT_BUSY);
+
+        return result;
+    }
+
+    static uint64_t BytesModified(const NVMem& nvmem)
+    {
+        return nvmem.counters().bytes_written + nvmem.counters().bytes_erased;
+    }
+
+    Report RunPartition(uint32_t num_saves, uint32_t first, uint32_t stride)
+    {
+        Report report{};
+        NVMem reference;
+        TPersist reference_persist{reference};
+        reference_persist.Init();
+
+        for (uint32_t n = 0; n < num_saves; n++)
+        {
+            if (n % stride == first)
+            {
+                // Measure the extent of this save on a copy.
+                NVMem nvmem;
+                std::memcpy(nvmem.data(), reference.data(), NVMem::kSize);
+                TPersist persist{nvmem};
+                persist.Init();
+                Save(persist, MakeData(n));
+                uint64_t extent = BytesModified(nvmem);
+
+                for (uint64_t cut = 0; cut < extent; cut++)
+                {
+                    report.cases++;
+
+                    if (!RunCase(reference, n, cut, report.mount_ns) &&
+                        report.failures++ == 0)
+                    {
+                        report.failed_save = n;
+                        report.failed_cut = cut;
+                    }
+                }
+            }
+
+            Save(reference_persist, MakeData(n));
+        }
+
+        return report;
+    }
+
+    bool RunCase(NVMem& reference, uint32_t n, uint64_t cut,
+        std::vector<uint64_t>& mount_ns)
+    {
+        NVMem nvmem;
+        std::memcpy(nvmem.data(), reference.data(), NVMem::kSize);
+
+        {
+            TPersist persist{nvmem};
+
+            if (persist.Init() != RESULT_SUCCESS)
+            {
+                return false;
+            }
+
+            nvmem.CutPowerAfter(cut);
+            Save(persist, MakeData(n));
+            nvmem.RestorePower();
+        }
+
+        TPersist persist{nvmem};
+        Clock::time_point start = Clock::now();
+        Result result = persist.Init();
+        mount_ns.push_back(std::chrono::duration_cast<
+            std::chrono::nanoseconds>(Clock::now() - start).count());
+
+        if (result != RESULT_SUCCESS)
+        {
+            return false;
+        }
+
+        TData data;
+        result = persist.Load(data);
+        bool is_new = (result == RESULT_SUCCESS && Equal(data, MakeData(n)));
+        bool is_old = (n == 0) ? (result == RESULT_FAIL_NO_DATA) :
+            (result == RESULT_SUCCESS && Equal(data, MakeData(n - 1)));
+
+        if (!is_new && !is_old)
+        {
+            return false;
+        }
+
+        // The memory must remain usable after recovery.
+        TData next = MakeData(n + 1);
+
+        if (Save(persist, next) != RESULT_SUCCESS)
+        {
+            return false;
+        }
+
+        TPersist remount{nvmem};
+        return remount.Init() == RESULT_SUCCESS &&
+            remount.Load(data) == RESULT_SUCCESS && Equal(data, next);
+    }
+};
+
+}
@@ -0,0 +1,180 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+namespace persist
+{
+
+// Tracer for hosted platforms which records timestamped events into a ring
+// buffer holding the most recent `capacity` events. The recorded events may be
+// exported in the Chrome trace event format, which can be viewed with
+// chrome://tracing or https://ui.perfetto.dev. Thread-safe.
+template <uint32_t capacity = 65536>
+class HostTracer
+{
+public:
+    static constexpr bool kEnabled = true;
+
+    HostTracer() : records_(capacity), origin_{Clock::now()} {}
+
+    void Begin(TraceEvent event, uint32_t location, uint32_t size)
+    {
+        Add('B', event, location, size);
+    }
+
+    void End(TraceEvent event, bool success)
+    {
+        Add('E', event, success, 0);
+    }
+
+    void Mark(TraceEvent event, uint32_t value)
+    {
+        Add('i', event, value, 0);
+    }
+
+    void Clear(void)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        head_ = 0;
+        count_ = 0;
+    }
+
+    uint32_t size(void) const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return count_;
+    }
+
+    void ExportChromeTrace(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        uint32_t first = (head_ + capacity - count_) % capacity;
+
+        out << "{\"traceEvents\":[";
+
+        for (uint32_t i = 0; i < count_; i++)
+        {
+            const Record& record = records_[(first + i) % capacity];
+
+            out << (i ? ",\n" : "\n")
+                << "{\"name\":\"" << EventName(record.event) << "\""
+                << ",\"ph\":\"" << record.phase << "\""
+                << ",\"ts\":" << record.timestamp_ns / 1000 << "."
+                << record.timestamp_ns / 100 % 10
+                << record.timestamp_ns / 10 % 10
+                << record.timestamp_ns % 10
+                << ",\"pid\":0,\"tid\":" << record.thread;
+
+            if (record.phase == 'B')
+            {
+                out << ",\"args\":{\"location\":" << record.arg0
+                    << ",\"size\":" << record.arg1 << "}";
+            }
+            else if (record.phase == 'E')
+            {
+                out << ",\"args\":{\"success\":"
+                    << (record.arg0 ? "true" : "false") << "}";
+            }
+            else
+            {
+                out << ",\"s\":\"t\",\"args\":{\"value\":" << record.arg0
+                    << "}";
+            }
+
+            out << "}";
+        }
+
+        out << "\n]}\n";
+    }
+
+protected:
+    static_assert(capacity > 0);
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Record
+    {
+        uint64_t timestamp_ns;
+        uint32_t thread;
+        uint32_t arg0;
+        uint32_t arg1;
+        TraceEvent event;
+        char phase;
+    };
+
+    mutable std::mutex mutex_;
+    std::vector<Record> records_;
+    Clock::time_point origin_;
+    uint32_t head_ = 0;
+    uint32_t count_ = 0;
+
+    void Add(char phase, TraceEvent event, uint32_t arg0, uint32_t arg1)
+    {
+        Record record;
+        record.timestamp_ns = std::chrono::duration_cast<
+            std::chrono::nanoseconds>(Clock::now() - origin_).count();
+        record.thread = static_cast<uint32_t>(
+            std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        record.arg0 = arg0;
+        record.arg1 = arg1;
+        record.event = event;
+        record.phase = phase;
+
+        std::lock_guard<std::mutex> lock{mutex_};
+        records_[head_] = record;
+        head_ = (head_ + 1) % capacity;
+        count_ += (count_ < capacity);
+    }
+
+    static const char* EventName(TraceEvent event)
+    {
+        switch (event)
+        {
+            case TRACE_READ: return "Read";
+            case TRACE_WRITABLE: return "Writable";
+            case TRACE_WRITE: return "Write";
+            case TRACE_ERASE: return "Erase";
+            case TRACE_SCAN: return "Scan";
+            case TRACE_PAGE_ROLLOVER: return "PageRollover";
+            case TRACE_CRC_MISMATCH: return "CrcMismatch";
+            case TRACE_SAVE: return "Save";
+            case TRACE_MOUNT: return "Mount";
+            case TRACE_CRC: return "Crc";
+            case TRACE_COMPARE: return "Compare";
+            case TRACE_COPY: return "Copy";
+        }
+
+        return "Unknown";
+    }
+};
+
+}
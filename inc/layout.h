@@ -0,0 +1,253 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include "nvmem_traits.h"
+
+namespace persist
+{
+
+// Layout policies determine the size of each Page and where Blocks are placed
+// within it. A Page begins with an optional header of `header_size` bytes,
+// reserved for use by classes derived from Persist, followed by equal slots,
+// each holding one or more Blocks back-to-back. Each policy provides
+// `Geometry<NVMem, block_size, header_size = 0>` with:
+//
+// - kSlotSize: size in bytes of a slot
+// - kBlocksPerSlot: number of Blocks in each slot
+// - kHeaderSize: size in bytes reserved at the start of each Page
+// - kPageSize: size in bytes of a Page, a multiple of the erase granularity
+// - kBlocksPerPage: number of Blocks in each Page
+// - BlockOffset(i): offset in bytes of the i-th Block from the start of its
+//   Page
+//
+// Changing the layout of an existing Persist region moves its Blocks, so the
+// previously saved data will not be found.
+//
+// Unless `page_granules` is given, a Page is the smallest number of erase
+// granules which holds the header and a slot.
+template <typename NVMem, uint32_t block_size, uint32_t slot_size,
+    uint32_t blocks_per_slot, uint32_t header_size = 0,
+    uint32_t page_granules = 0>
+struct SlotGeometry
+{
+    static constexpr uint32_t kSlotSize = slot_size;
+    static constexpr uint32_t kBlocksPerSlot = blocks_per_slot;
+    static constexpr uint32_t kHeaderSize = header_size;
+    static constexpr uint32_t kMinPageGranules =
+        (header_size + slot_size + NVMem::kEraseGranularity - 1) /
+        NVMem::kEraseGranularity;
+    static constexpr uint32_t kPageSize = NVMem::kEraseGranularity *
+        (page_granules ? page_granules : kMinPageGranules);
+    static constexpr uint32_t kBlocksPerPage =
+        (kPageSize - header_size) / slot_size * blocks_per_slot;
+
+    static_assert(block_size * blocks_per_slot <= slot_size);
+    static_assert(page_granules == 0 || page_granules >= kMinPageGranules);
+
+    static constexpr uint32_t BlockOffset(uint32_t block_n)
+    {
+        return header_size + block_n / blocks_per_slot * slot_size +
+            block_n % blocks_per_slot * block_size;
+    }
+};
+
+// Default layout. Blocks are packed back-to-back, so a Block may straddle the
+// boundary between two program pages of the memory.
+struct PackedLayout
+{
+    template <typename NVMem, uint32_t block_size, uint32_t header_size = 0>
+    using Geometry =
+        SlotGeometry<NVMem, block_size, block_size, 1, header_size>;
+};
+
+// Blocks are placed so that each one spans as few program pages as possible,
+// using NVMem::kProgramPageSize. As many Blocks as fit are packed into each
+// program page, leaving the remainder unused. A Block larger than a program
+// page starts at a program page boundary, as does the first slot after a page
+// header. This trades some capacity for fewer program operations per save.
+struct ProgramPageLayout
+{
+    template <typename NVMem, uint32_t block_size, uint32_t header_size>
+    struct Slots
+    {
+        static constexpr uint32_t kProgramPage = ProgramPageSize<NVMem>::value;
+
+        // Otherwise a program page could straddle the boundary between Pages.
+        static_assert(NVMem::kEraseGranularity % kProgramPage == 0,
+            "kProgramPageSize must divide kEraseGranularity");
+        static_assert(kProgramPage % NVMem::kWriteGranularity == 0,
+            "kProgramPageSize must be a multiple of kWriteGranularity");
+
+        static constexpr uint32_t RoundUp(uint32_t size)
+        {
+            return (size + kProgramPage - 1) / kProgramPage * kProgramPage;
+        }
+
+        using Geometry = SlotGeometry<NVMem, block_size,
+            (block_size <= kProgramPage) ? kProgramPage : RoundUp(block_size),
+            (block_size <= kProgramPage) ? kProgramPage / block_size : 1,
+            RoundUp(header_size)>;
+    };
+
+    template <typename NVMem, uint32_t block_size, uint32_t header_size = 0>
+    using Geometry =
+        typename Slots<NVMem, block_size, header_size>::Geometry;
+};
+
+// Chooses the Page size, up to `max_granules` erase granules, which maximizes
+// the number of Blocks in the region, placing Blocks within the Page as `Inner`
+// does. This is the number of saves made per erase of each granule. Where a
+// Block doesn't evenly divide the erase granularity, a larger Page can hold
+// more Blocks in the same area, but it also takes longer to erase and may leave
+// more of the region unused. Pages are kept small enough that the region holds
+// at least two, and the smallest of equally good sizes is chosen.
+template <typename Inner = PackedLayout, uint32_t max_granules = 8>
+struct OptimalLayout
+{
+    template <typename NVMem, uint32_t block_size, uint32_t header_size>
+    struct Choice
+    {
+        using Minimal = typename Inner::template Geometry<NVMem, block_size,
+            header_size>;
+
+        static constexpr uint32_t NumBlocks(uint32_t page_size)
+        {
+            return NVMem::kSize / page_size *
+                ((page_size - Minimal::kHeaderSize) / Minimal::kSlotSize *
+                Minimal::kBlocksPerSlot);
+        }
+
+        static constexpr uint32_t Choose(void)
+        {
+            uint32_t granule = NVMem::kEraseGranularity;
+            uint32_t best = Minimal::kMinPageGranules;
+            uint32_t best_blocks = NumBlocks(best * granule);
+
+            for (uint32_t n = best + 1; n <= max_granules &&
+                n * granule <= NVMem::kSize / 2; n++)
+            {
+                uint32_t blocks = NumBlocks(n * granule);
+
+                if (blocks > best_blocks)
+                {
+                    best = n;
+                    best_blocks = blocks;
+                }
+            }
+
+            return best;
+        }
+
+        using Geometry = SlotGeometry<NVMem, block_size, Minimal::kSlotSize,
+            Minimal::kBlocksPerSlot, Minimal::kHeaderSize, Choose()>;
+    };
+
+    template <typename NVMem, uint32_t block_size, uint32_t header_size = 0>
+    using Geometry =
+        typename Choice<NVMem, block_size, header_size>::Geometry;
+};
+
+// Adapts `Inner` to reserve a header of `header_size` bytes at the start of
+// each Page.
+template <typename Inner, uint32_t header_size>
+struct PageHeaderLayout
+{
+    template <typename NVMem, uint32_t block_size, uint32_t = 0>
+    using Geometry =
+        typename Inner::template Geometry<NVMem, block_size, header_size>;
+};
+
+// Adapts `Inner` to reserve `trailer_size` bytes after each Block, for use by
+// classes derived from Persist. GetLayoutReport() counts trailers as wasted.
+template <typename Inner, uint32_t trailer_size>
+struct BlockTrailerLayout
+{
+    template <typename NVMem, uint32_t block_size, uint32_t header_size = 0>
+    using Geometry = typename Inner::template Geometry<NVMem,
+        block_size + trailer_size, header_size>;
+};
+
+// Space efficiency and endurance of a layout. See Persist::GetLayoutReport().
+struct LayoutReport
+{
+    uint32_t block_size;
+    uint32_t page_size;
+    uint32_t blocks_per_page;
+    uint32_t num_blocks;
+    uint32_t num_pages;
+
+    // Bytes of each Block which pad the Data, sequence number and CRC to the
+    // write granularity.
+    uint32_t padding_per_block;
+
+    // Bytes of each Page which hold no Block.
+    uint32_t wasted_per_page;
+
+    // Bytes of the region beyond the last Page.
+    uint32_t wasted_per_region;
+
+    // Saves made for each erase granule erased.
+    float saves_per_erase;
+
+    // Saves made in one full cycle through the region, during which each erase
+    // granule is erased once.
+    uint32_t saves_per_region_cycle;
+};
+
+// Program operations needed to write a Block of `block_size` bytes at each
+// position of a Page laid out according to `Geometry`.
+struct ProgramCost
+{
+    // Greatest number of program operations for a single save.
+    uint32_t max;
+
+    // Mean number of program operations per save, over every Block in a Page.
+    float mean;
+};
+
+template <typename NVMem, uint32_t block_size, typename Geometry>
+constexpr ProgramCost CalculateProgramCost(void)
+{
+    constexpr uint32_t kProgramPage = ProgramPageSize<NVMem>::value;
+    static_assert(NVMem::kEraseGranularity % kProgramPage == 0);
+    static_assert(kProgramPage % NVMem::kWriteGranularity == 0);
+
+    uint32_t max = 0;
+    uint32_t total = 0;
+
+    for (uint32_t i = 0; i < Geometry::kBlocksPerPage; i++)
+    {
+        uint32_t first = Geometry::BlockOffset(i) / kProgramPage;
+        uint32_t last =
+            (Geometry::BlockOffset(i) + block_size - 1) / kProgramPage;
+        uint32_t ops = last - first + 1;
+        max = (ops > max) ? ops : max;
+        total += ops;
+    }
+
+    return ProgramCost{max, float(total) / Geometry::kBlocksPerPage};
+}
+
+}
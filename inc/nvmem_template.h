@@ -27,6 +27,10 @@
 // This is a template interface for the NVMem type used by Persist which should
 // be adapted to the non-volatile memory used by our application. Note that
 // Persist assumes that NVMem is already initialized.
+//
+// Optional members are detected by their presence, so they are shown here
+// commented out, with example values. Define them only if the memory supports
+// them.
 struct NVMemTemplate
 {
     // Total size in bytes of the NVMem region.
@@ -44,6 +48,27 @@ struct NVMemTemplate
     // Persist will use this value to fill any padding.
     static constexpr uint8_t kFillByte = 0;
 
+    // Optional. Sizes of the erase commands supported by the memory, in
+    // ascending order, the first being kEraseGranularity. Each must be a
+    // multiple of the previous. If present, Persist erases a range by calling
+    // Erase() with the largest size to which the location is aligned and which
+    // fits within the range, so each call corresponds to a single command.
+    // Locations are aligned relative to the beginning of the NVMem region.
+    // static constexpr uint32_t kEraseSizes[] = {4096, 32768, 65536};
+
+    // Optional. Size of the memory's internal program page, e.g. 256 bytes for
+    // serial NOR flash. A write which spans several program pages costs one
+    // program operation for each. Must be a multiple of kWriteGranularity and
+    // divide kEraseGranularity. Used by ProgramPageLayout; see layout.h.
+    // static constexpr uint32_t kProgramPageSize = 256;
+
+    // Optional. True if Write() may be called more than once on the same bytes
+    // between erases, each time changing further bits away from kFillByte and
+    // leaving bits which are already changed as they are, as with most NOR
+    // flash. Memories which store ECC alongside the data, such as the internal
+    // flash of many microcontrollers, usually don't allow this.
+    // static constexpr bool kSupportsReprogram = true;
+
     // For each of these functions, `location` is an offset in bytes from the
     // beginning of the NVMem region.
 
@@ -62,4 +87,15 @@ struct NVMemTemplate
     // Erase `size` bytes starting at `location`.  Return `true` on success or
     // `false` on failure.
     bool Erase(uint32_t location, uint32_t size);
+
+    // Optional. If the memory can suspend an erase in progress, e.g. one
+    // started by another user of the same device or still running in the
+    // background, Persist calls SuspendErase() before each Read() or
+    // Writable() so that the read need not wait for the erase to finish.
+    // Return `true` if an erase was suspended, in which case Persist calls
+    // ResumeErase() after the read, or `false` if no erase is running or it is
+    // already suspended. Persist also holds a suspension across the reads of
+    // Init(). The range being erased will not be read.
+    // bool SuspendErase(void);
+    // void ResumeErase(void);
 };
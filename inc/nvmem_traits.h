@@ -0,0 +1,107 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace persist
+{
+
+// Detection of the optional members of the NVMem interface. See
+// nvmem_template.h.
+
+// True if NVMem::kEraseSizes is present, in which case it must list sizes in
+// ascending order, each a multiple of the erase granularity.
+template <typename NVMem, typename = void>
+struct HasEraseSizes : std::false_type {};
+
+template <typename NVMem>
+struct HasEraseSizes<NVMem, std::void_t<decltype(NVMem::kEraseSizes)>> :
+    std::true_type
+{
+    static constexpr bool Ascending(void)
+    {
+        uint32_t previous = 0;
+
+        for (uint32_t size : NVMem::kEraseSizes)
+        {
+            if (size <= previous)
+            {
+                return false;
+            }
+
+            previous = size;
+        }
+
+        return true;
+    }
+
+    static constexpr bool Aligned(void)
+    {
+        for (uint32_t size : NVMem::kEraseSizes)
+        {
+            if (size % NVMem::kEraseGranularity != 0)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    static_assert(Ascending(), "NVMem::kEraseSizes must be ascending");
+    static_assert(Aligned(),
+        "NVMem::kEraseSizes must be multiples of kEraseGranularity");
+};
+
+// Size of the memory's internal program page, or the write granularity if
+// kProgramPageSize is not provided.
+template <typename NVMem, typename = void>
+struct ProgramPageSize :
+    std::integral_constant<uint32_t, NVMem::kWriteGranularity> {};
+
+template <typename NVMem>
+struct ProgramPageSize<NVMem, std::void_t<decltype(NVMem::kProgramPageSize)>> :
+    std::integral_constant<uint32_t, NVMem::kProgramPageSize> {};
+
+// True if NVMem::kSupportsReprogram is present and true.
+template <typename NVMem, typename = void>
+struct SupportsReprogram : std::false_type {};
+
+template <typename NVMem>
+struct SupportsReprogram<NVMem,
+    std::void_t<decltype(NVMem::kSupportsReprogram)>> :
+    std::integral_constant<bool, NVMem::kSupportsReprogram> {};
+
+template <typename NVMem, typename = void>
+struct HasEraseSuspend : std::false_type {};
+
+template <typename NVMem>
+struct HasEraseSuspend<NVMem, std::void_t<
+    decltype(std::declval<NVMem&>().SuspendErase()),
+    decltype(std::declval<NVMem&>().ResumeErase())>> :
+    std::true_type {};
+
+}
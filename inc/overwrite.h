@@ -0,0 +1,511 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include "nvmem_traits.h"
+#include "../persist.h"
+
+namespace persist
+{
+
+// Record following a Block of OverwritePersist, giving the sequence number and
+// CRC of data programmed over the Block's original data.
+template <typename NVMem>
+struct __attribute__ ((packed)) OverwriteRecord
+{
+    static constexpr uint32_t kUnpaddedSize = 2 * sizeof(uint16_t);
+
+    uint16_t sequence_n;
+    uint16_t crc;
+    uint8_t padding[(NVMem::kWriteGranularity -
+        kUnpaddedSize % NVMem::kWriteGranularity) % NVMem::kWriteGranularity];
+};
+
+// Persist which, when the new Data can be produced from that of a Block by
+// programming alone, e.g. because only flags have been set, writes it over the
+// Block rather than into a new one. Requires NVMem::kSupportsReprogram.
+//
+// Each Block is followed by `max_overwrites` records. After programming the
+// Data in place, a blank record is written with a new sequence number and the
+// CRC of the new Data; a Block is valid if its last valid record, or failing
+// that its own CRC, matches its Data. The newest Block is never overwritten:
+// instead the Block it superseded, which is kept as a standby, is brought up
+// to date and becomes the newest. If power is lost part way, the standby
+// becomes invalid but the newest Block is intact, so saves remain
+// fault-tolerant. Saves therefore alternate between two Blocks until one runs
+// out of records or the Data can't be reached by programming, when a new Block
+// is written as usual.
+//
+// The standby is found by Init() only if its sequence number immediately
+// precedes the newest. Arm() and EmergencySave() are not available.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    uint32_t max_overwrites = 3, typename Equality = BytewiseEqual>
+class OverwritePersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer,
+    BlockTrailerLayout<Layout,
+        max_overwrites * sizeof(OverwriteRecord<NVMem>)>, Equality>
+{
+public:
+    OverwritePersist(NVMem& nvmem) : Base{nvmem} {}
+
+    Result Init(void)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_MOUNT, 0, Base::kNumBlocks);
+        bool suspended = this->SuspendErase();
+        this->crc_.Init();
+        Result result = Mount();
+        this->ResumeErase(suspended);
+        this->tracer_.End(TRACE_MOUNT, result == RESULT_SUCCESS);
+        this->stats_.InitDone(start);
+        return result;
+    }
+
+    Result Save(const TData& data)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_SAVE, 0, sizeof(TData));
+        this->stats_.SaveRequested();
+        Result result = RESULT_SUCCESS;
+
+        if (this->DataIsSame(data))
+        {
+            this->stats_.SaveSuppressed();
+        }
+        else
+        {
+            uint8_t image[sizeof(TData)];
+            Equality::Store(image, data);
+            result = CanOverwrite(image) ? Overwrite(image) : WriteBlock(data);
+        }
+
+        this->tracer_.End(TRACE_SAVE, result == RESULT_SUCCESS);
+        this->stats_.SaveDone(start);
+        return result;
+    }
+
+    Result Format(void)
+    {
+        standby_block_n_ = -1;
+
+        if (!this->EraseRange(0, Base::kNumPages * Base::kPageSize))
+        {
+            Mount();
+            return RESULT_FAIL_ERASE;
+        }
+
+        for (uint32_t i = 0; i < Base::kNumPages; i++)
+        {
+            this->stats_.PageErased(i);
+        }
+
+        this->active_block_n_ = -1;
+        this->sequence_ = 0;
+        this->ResetWriteState();
+        return RESULT_SUCCESS;
+    }
+
+    Result Arm(uint32_t stable_size = 0) = delete;
+    Result EmergencySave(const TData& data) = delete;
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, BlockTrailerLayout<Layout,
+            max_overwrites * sizeof(OverwriteRecord<NVMem>)>, Equality>;
+    using TSequenceNum = typename Base::TSequenceNum;
+    using TCRC = typename Base::TCRC;
+    using Block = typename Base::Block;
+    using Record = OverwriteRecord<NVMem>;
+
+    static constexpr uint32_t kRecordsSize = max_overwrites * sizeof(Record);
+
+    static_assert(SupportsReprogram<NVMem>::value,
+        "NVMem does not support reprogramming");
+    static_assert(max_overwrites > 0);
+
+    // Overwrites advance the sequence number without consuming Blocks, so a
+    // Block could otherwise fall more than half the sequence number space
+    // behind the newest before its Page is erased.
+    static_assert(uint64_t{Base::kNumBlocks} * (max_overwrites + 1) <=
+        Base::kSequenceWindow,
+        "Region holds too many Blocks to overwrite in place");
+
+    // Records used by the newest Block.
+    uint32_t active_records_;
+
+    // Block superseded by the newest, or -1 if unknown. standby_ holds its
+    // contents and standby_records_ the number of records it has used.
+    int32_t standby_block_n_ = -1;
+    uint32_t standby_records_;
+    Block standby_;
+
+    static bool IsBlank(const Record& record)
+    {
+        auto byte = reinterpret_cast<const uint8_t*>(&record);
+        return std::all_of(byte, byte + sizeof(Record),
+            [](uint8_t b) { return b == NVMem::kFillByte; });
+    }
+
+    // Bits may only be changed away from their erased state.
+    static uint8_t Program(uint8_t old_byte, uint8_t new_byte)
+    {
+        return (NVMem::kFillByte == 0xFF) ? (old_byte & new_byte) :
+            (old_byte | new_byte);
+    }
+
+    TCRC GetRecordCRC(const Block& block, TSequenceNum sequence)
+    {
+        constexpr uint32_t kSize = sizeof(TData) + sizeof(TSequenceNum);
+        this->tracer_.Begin(TRACE_CRC, 0, kSize);
+        TCRC seed = datatype_version;
+        this->crc_.Seed(seed | (~seed << 8));
+        this->crc_.Process(&block.data, sizeof(TData));
+        TCRC result = this->crc_.Process(&sequence, sizeof(sequence));
+        this->tracer_.End(TRACE_CRC, true);
+        return result;
+    }
+
+    // Reads `block_n` and its records into `block`. Returns RESULT_SUCCESS
+    // with the Block's current sequence number if it is valid, or
+    // RESULT_FAIL_NO_DATA if not. `records` is set to the number of records
+    // used, including any left corrupt by a loss of power.
+    Result ReadBlock(uint32_t block_n, Block& block, TSequenceNum& sequence,
+        uint32_t& records)
+    {
+        Record record[max_overwrites];
+        uint32_t location = this->BlockLocation(block_n);
+
+        if (!this->ReadMem(&block, location, Base::kBlockSize) ||
+            !this->ReadMem(&record, location + Base::kBlockSize, kRecordsSize))
+        {
+            return RESULT_FAIL_READ;
+        }
+
+        records = 0;
+
+        for (uint32_t i = max_overwrites; i-- > 0;)
+        {
+            if (!IsBlank(record[i]))
+            {
+                records = std::max(records, i + 1);
+
+                if (record[i].crc ==
+                    GetRecordCRC(block, record[i].sequence_n))
+                {
+                    sequence = record[i].sequence_n;
+                    return RESULT_SUCCESS;
+                }
+            }
+        }
+
+        if (block.crc == this->GetCRC(block))
+        {
+            sequence = block.sequence_n;
+            return RESULT_SUCCESS;
+        }
+
+        return RESULT_FAIL_NO_DATA;
+    }
+
+    // Finds the newest valid Block and the standby which precedes it.
+    Result Mount(void)
+    {
+        this->active_block_n_ = -1;
+        this->sequence_ = 0;
+        this->ResetWriteState();
+        active_records_ = 0;
+        standby_block_n_ = -1;
+        TSequenceNum standby_sequence = 0;
+        uint32_t crc_failures = 0;
+        this->tracer_.Begin(TRACE_SCAN, 0, Base::kNumBlocks);
+
+        for (uint32_t i = 0; i < Base::kNumBlocks; i++)
+        {
+            TSequenceNum sequence;
+            uint32_t records;
+            Result result = ReadBlock(i, this->block_, sequence, records);
+
+            if (result == RESULT_FAIL_READ)
+            {
+                this->active_block_n_ = -1;
+                standby_block_n_ = -1;
+                this->tracer_.End(TRACE_SCAN, false);
+                return result;
+            }
+
+            if (result == RESULT_SUCCESS)
+            {
+                if (this->active_block_n_ == -1 ||
+                    Base::IsNewer(sequence, this->sequence_))
+                {
+                    standby_block_n_ = this->active_block_n_;
+                    standby_sequence = this->sequence_;
+                    this->active_block_n_ = i;
+                    this->sequence_ = sequence;
+                }
+                else if (standby_block_n_ == -1 ||
+                    Base::IsNewer(sequence, standby_sequence))
+                {
+                    standby_block_n_ = i;
+                    standby_sequence = sequence;
+                }
+            }
+            else if constexpr (Base::StatsRecorder::kEnabled ||
+                Tracer::kEnabled)
+            {
+                if (records != 0 || !Base::IsBlank(this->block_))
+                {
+                    crc_failures++;
+                    this->tracer_.Mark(TRACE_CRC_MISMATCH, i);
+                }
+            }
+        }
+
+        this->tracer_.End(TRACE_SCAN, true);
+        this->stats_.MountScanned(Base::kNumBlocks, crc_failures);
+        this->ResetWriteState();
+
+        if (standby_sequence != TSequenceNum(this->sequence_ - 1))
+        {
+            standby_block_n_ = -1;
+        }
+
+        TSequenceNum sequence;
+        Result result = RESULT_SUCCESS;
+
+        if (this->active_block_n_ != -1)
+        {
+            result = ReadBlock(this->active_block_n_, this->block_, sequence,
+                active_records_);
+        }
+
+        if (result == RESULT_SUCCESS && standby_block_n_ != -1)
+        {
+            result = ReadBlock(standby_block_n_, standby_, sequence,
+                standby_records_);
+        }
+
+        if (result != RESULT_SUCCESS)
+        {
+            this->active_block_n_ = -1;
+            standby_block_n_ = -1;
+            return RESULT_FAIL_READ;
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    // True if the standby has a blank record and `image`, the Data to be
+    // saved, can be programmed over its Data.
+    bool CanOverwrite(const uint8_t* image)
+    {
+        if (standby_block_n_ == -1 || standby_records_ == max_overwrites)
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < sizeof(TData); i++)
+        {
+            if (Program(standby_.data[i], image[i]) != image[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Programs `image` over the standby's Data, then writes its next record,
+    // after which it is the newest Block. Only the write units holding changed
+    // bytes are written.
+    Result Overwrite(const uint8_t* image)
+    {
+        constexpr uint32_t kUnit = NVMem::kWriteGranularity;
+        uint32_t first = sizeof(TData);
+        uint32_t last = 0;
+
+        for (uint32_t i = 0; i < sizeof(TData); i++)
+        {
+            if (standby_.data[i] != image[i])
+            {
+                first = std::min(first, i);
+                last = i + 1;
+            }
+        }
+
+        uint32_t location = this->BlockLocation(standby_block_n_);
+        TSequenceNum sequence = this->sequence_ + 1;
+        this->armed_block_n_ = -1;
+
+        this->tracer_.Begin(TRACE_COPY, 0, sizeof(TData));
+        std::memcpy(&standby_.data, image, sizeof(TData));
+        this->tracer_.End(TRACE_COPY, true);
+
+        Record record;
+        record.sequence_n = sequence;
+        record.crc = GetRecordCRC(standby_, sequence);
+        std::memset(&record.padding, NVMem::kFillByte, sizeof(record.padding));
+
+        if (first < last)
+        {
+            first = first / kUnit * kUnit;
+            last = (last + kUnit - 1) / kUnit * kUnit;
+
+            if (!this->WriteMem(location + first,
+                reinterpret_cast<const uint8_t*>(&standby_) + first,
+                last - first))
+            {
+                RecoverFailedOverwrite(sequence);
+                return RESULT_FAIL_WRITE;
+            }
+        }
+
+        if (!this->WriteMem(location + Base::kBlockSize +
+            standby_records_ * sizeof(Record), &record, sizeof(Record)))
+        {
+            RecoverFailedOverwrite(sequence);
+            return RESULT_FAIL_WRITE;
+        }
+
+        standby_records_++;
+        PromoteStandby(sequence);
+        this->stats_.BlockOverwritten();
+        return RESULT_SUCCESS;
+    }
+
+    // Makes the standby, now valid with sequence number `sequence`, the newest
+    // Block, and the newest Block the standby.
+    void PromoteStandby(TSequenceNum sequence)
+    {
+        std::swap(this->block_, standby_);
+        std::swap(this->active_block_n_, standby_block_n_);
+        std::swap(active_records_, standby_records_);
+        this->sequence_ = sequence;
+    }
+
+    // Restores a consistent state after a failed overwrite of the standby by
+    // re-reading only the standby. The newest Block was not touched, so it
+    // remains valid whatever became of the standby.
+    void RecoverFailedOverwrite(TSequenceNum sequence)
+    {
+        // The overwrite may have completed despite reporting failure, in
+        // which case the standby is now the newest and would be chosen by a
+        // remount.
+        TSequenceNum standby_sequence;
+
+        if (ReadBlock(standby_block_n_, standby_, standby_sequence,
+            standby_records_) == RESULT_SUCCESS &&
+            standby_sequence == sequence)
+        {
+            PromoteStandby(sequence);
+            return;
+        }
+
+        standby_block_n_ = -1;
+    }
+
+    // Writes `data` to a new Block, after which the newest Block becomes the
+    // standby.
+    Result WriteBlock(const TData& data)
+    {
+        int32_t block_n;
+        TSequenceNum sequence;
+        Result result = this->FindNextBlock(block_n, sequence);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        this->armed_block_n_ = -1;
+        int32_t previous_block_n = this->active_block_n_;
+        TSequenceNum previous_sequence = this->sequence_;
+        standby_block_n_ = this->active_block_n_;
+        standby_records_ = active_records_;
+        standby_ = this->block_;
+
+        this->tracer_.Begin(TRACE_COPY, 0, sizeof(TData));
+        Equality::Store(this->block_.data, data);
+        std::memset(&this->block_.padding, NVMem::kFillByte,
+            Base::kBlockPaddingSize);
+        this->tracer_.End(TRACE_COPY, true);
+        this->block_.sequence_n = sequence;
+        this->block_.crc = this->GetCRC(this->block_);
+
+        this->active_block_n_ = block_n;
+        this->head_block_n_ = block_n;
+        this->sequence_ = sequence;
+        active_records_ = 0;
+
+        if (!this->WriteMem(this->BlockLocation(block_n), &this->block_,
+            Base::kBlockSize))
+        {
+            RecoverFailedWrite(previous_block_n, previous_sequence);
+            return RESULT_FAIL_WRITE;
+        }
+
+        this->stats_.BlockWritten();
+        return RESULT_SUCCESS;
+    }
+
+    // Restores a consistent state after a failed write to the head Block by
+    // re-reading only that Block and the previously newest, as Persist does,
+    // but taking account of their records. The previous standby has been
+    // replaced, so none is kept unless the write completed. A full scan is
+    // only needed if the previously newest Block can no longer be verified.
+    void RecoverFailedWrite(int32_t previous_block_n,
+        TSequenceNum previous_sequence)
+    {
+        // The write may have completed despite reporting failure, in which
+        // case the Block is now the newest and would be chosen by a remount.
+        TSequenceNum sequence;
+
+        if (ReadBlock(this->head_block_n_, this->block_, sequence,
+            active_records_) == RESULT_SUCCESS && sequence == this->sequence_)
+        {
+            return;
+        }
+
+        this->active_block_n_ = previous_block_n;
+        this->sequence_ = previous_sequence;
+        standby_block_n_ = -1;
+
+        if (this->active_block_n_ != -1)
+        {
+            if (ReadBlock(this->active_block_n_, this->block_, sequence,
+                active_records_) != RESULT_SUCCESS ||
+                sequence != this->sequence_)
+            {
+                Mount();
+            }
+        }
+    }
+};
+
+}
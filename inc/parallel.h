@@ -0,0 +1,144 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Persist with a multithreaded Init() for large regions on hosted platforms.
+// The block range is split into contiguous partitions which are scanned
+// concurrently, and the newest block of each partition is then reduced in
+// partition order using the same sequence number comparison as the serial
+// scan, yielding the same result. NVMem must tolerate concurrent reads.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
+class ParallelPersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer, Layout, Equality>
+{
+public:
+    ParallelPersist(NVMem& nvmem) : Base{nvmem} {}
+
+    // Uses one thread per hardware thread by default.
+    Result Init(uint32_t num_threads = std::thread::hardware_concurrency())
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_MOUNT, 0, Base::kNumBlocks);
+        bool suspended = this->SuspendErase();
+        Result result = Mount(num_threads);
+        this->ResumeErase(suspended);
+        this->tracer_.End(TRACE_MOUNT, result == RESULT_SUCCESS);
+        this->stats_.InitDone(start);
+        return result;
+    }
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality>;
+    using Block = typename Base::Block;
+    using TSequenceNum = typename Base::TSequenceNum;
+
+    struct Partition
+    {
+        Result result;
+        int32_t block_n;
+        TSequenceNum sequence;
+        uint32_t crc_failures;
+    };
+
+    Result Mount(uint32_t num_threads)
+    {
+        this->crc_.Init();
+        num_threads = std::clamp<uint32_t>(num_threads, 1, Base::kNumBlocks);
+
+        std::vector<Partition> partitions(num_threads);
+        std::vector<std::thread> threads;
+        threads.reserve(num_threads - 1);
+
+        for (uint32_t i = 0; i < num_threads; i++)
+        {
+            uint32_t first = uint64_t{Base::kNumBlocks} * i / num_threads;
+            uint32_t last = uint64_t{Base::kNumBlocks} * (i + 1) / num_threads;
+            Partition& partition = partitions[i];
+
+            auto scan = [this, first, last, &partition](void)
+            {
+                Block block;
+                Crc16 crc;
+                crc.Init();
+                partition.result = this->FindNewestBlock(first, last, block,
+                    crc, partition.block_n, partition.sequence,
+                    partition.crc_failures);
+            };
+
+            if (i + 1 < num_threads)
+            {
+                threads.emplace_back(scan);
+            }
+            else
+            {
+                scan();
+            }
+        }
+
+        for (std::thread& thread : threads)
+        {
+            thread.join();
+        }
+
+        this->active_block_n_ = -1;
+        this->sequence_ = 0;
+        uint32_t crc_failures = 0;
+
+        for (const Partition& partition : partitions)
+        {
+            if (partition.result != RESULT_SUCCESS)
+            {
+                this->active_block_n_ = -1;
+                this->ResetWriteState();
+                return partition.result;
+            }
+
+            if (partition.block_n != -1 && (this->active_block_n_ == -1 ||
+                Base::IsNewer(partition.sequence, this->sequence_)))
+            {
+                this->active_block_n_ = partition.block_n;
+                this->sequence_ = partition.sequence;
+            }
+
+            crc_failures += partition.crc_failures;
+        }
+
+        this->stats_.MountScanned(Base::kNumBlocks, crc_failures);
+        this->ResetWriteState();
+        return this->ReadActiveBlock();
+    }
+};
+
+}
@@ -0,0 +1,104 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace persist
+{
+
+// Tracer which measures the time spent in each phase of Save() and Init() using
+// a cycle counter. `Counter` must provide a function `static T Now(void)` which
+// returns the current count as an unsigned integer type T, wrapping around at
+// its maximum. Phases may nest, e.g. TRACE_CRC within TRACE_SCAN within
+// TRACE_MOUNT, so time spent in a phase is also counted in its enclosing
+// phases. For example, the fraction of mount time spent calculating CRCs is
+// phase(TRACE_CRC).total / phase(TRACE_MOUNT).total.
+//
+// Not thread-safe, so it must not be used with ParallelPersist.
+template <typename Counter>
+class CycleProfiler
+{
+public:
+    static constexpr bool kEnabled = true;
+
+    using Ticks = decltype(Counter::Now());
+
+    struct Phase
+    {
+        uint32_t count;
+        uint64_t total;
+        Ticks max;
+    };
+
+    void Begin(TraceEvent event, uint32_t, uint32_t)
+    {
+        start_[event] = Counter::Now();
+    }
+
+    void End(TraceEvent event, bool)
+    {
+        Ticks elapsed = Counter::Now() - start_[event];
+        Phase& phase = phases_[event];
+        phase.count++;
+        phase.total += elapsed;
+        phase.max = (elapsed > phase.max) ? elapsed : phase.max;
+    }
+
+    void Mark(TraceEvent, uint32_t) {}
+
+    const Phase& phase(TraceEvent event) const
+    {
+        return phases_[event];
+    }
+
+    void Clear(void)
+    {
+        for (Phase& phase : phases_)
+        {
+            phase = Phase{};
+        }
+    }
+
+protected:
+    Ticks start_[kNumTraceEvents] = {};
+    Phase phases_[kNumTraceEvents] = {};
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+// Reads the x86 time stamp counter.
+struct TscCounter
+{
+    static uint64_t Now(void)
+    {
+        return __rdtsc();
+    }
+};
+#endif
+
+}
@@ -0,0 +1,92 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+#include "nvmem_traits.h"
+
+namespace persist
+{
+
+// NVMem adapter which exposes a contiguous sub-range of another NVMem, so that
+// several Persist instances may share one memory device. `offset` should be a
+// multiple of the parent's erase granularity.
+template <typename NVMem, uint32_t region_size>
+class NVMemRegion
+{
+public:
+    static constexpr uint32_t kSize = region_size;
+    static constexpr uint32_t kEraseGranularity = NVMem::kEraseGranularity;
+    static constexpr uint32_t kWriteGranularity = NVMem::kWriteGranularity;
+    static constexpr uint8_t kFillByte = NVMem::kFillByte;
+    static constexpr uint32_t kProgramPageSize = ProgramPageSize<NVMem>::value;
+    static constexpr bool kSupportsReprogram = SupportsReprogram<NVMem>::value;
+
+    static_assert(region_size <= NVMem::kSize);
+
+    NVMemRegion(NVMem& nvmem, uint32_t offset) :
+        nvmem_{nvmem},
+        offset_{offset}
+    {}
+
+    bool Read(void* dst, uint32_t location, uint32_t size)
+    {
+        return nvmem_.Read(dst, offset_ + location, size);
+    }
+
+    bool Writable(uint32_t location, uint32_t size)
+    {
+        return nvmem_.Writable(offset_ + location, size);
+    }
+
+    bool Write(uint32_t location, const void* src, uint32_t size)
+    {
+        return nvmem_.Write(offset_ + location, src, size);
+    }
+
+    bool Erase(uint32_t location, uint32_t size)
+    {
+        return nvmem_.Erase(offset_ + location, size);
+    }
+
+    template <typename T = NVMem,
+        std::enable_if_t<HasEraseSuspend<T>::value, bool> = true>
+    bool SuspendErase(void)
+    {
+        return nvmem_.SuspendErase();
+    }
+
+    template <typename T = NVMem,
+        std::enable_if_t<HasEraseSuspend<T>::value, bool> = true>
+    void ResumeErase(void)
+    {
+        nvmem_.ResumeErase();
+    }
+
+protected:
+    NVMem& nvmem_;
+    uint32_t offset_;
+};
+
+}
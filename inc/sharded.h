@@ -0,0 +1,187 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include "../persist.h"
+#include "region.h"
+
+namespace persist
+{
+
+// Splits an NVMem region into `num_shards` equally sized sub-regions, each
+// managed by an independent Persist instance with its own write cursor and
+// wear-leveling. Concurrent saves from different threads are directed to
+// different shards and proceed in parallel. Every record is tagged with a
+// 64-bit generation number, and Init() loads the record with the highest
+// generation across all shards.
+//
+// NVMem must tolerate concurrent operations on disjoint ranges. Only Init(),
+// Load() and Save() are provided, and each shard uses Persist's default
+// policies.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    uint32_t num_shards, bool assert_fault_tolerant = true>
+class ShardedPersist
+{
+public:
+    ShardedPersist(NVMem& nvmem) :
+        ShardedPersist{nvmem, std::make_index_sequence<num_shards>{}}
+    {}
+
+    // Must not be called concurrently with any other member function.
+    Result Init(void)
+    {
+        valid_ = false;
+        latest_.generation = 0;
+
+        for (uint32_t i = 0; i < num_shards; i++)
+        {
+            Result result = shards_[i].Init();
+
+            if (result != RESULT_SUCCESS)
+            {
+                valid_ = false;
+                return result;
+            }
+
+            Record record;
+
+            if (shards_[i].Load(record) == RESULT_SUCCESS &&
+                (!valid_ || record.generation > latest_.generation))
+            {
+                latest_ = record;
+                valid_ = true;
+            }
+        }
+
+        generation_.store(latest_.generation, std::memory_order_relaxed);
+        return RESULT_SUCCESS;
+    }
+
+    Result Load(TData& data)
+    {
+        std::lock_guard<std::mutex> lock{latest_mutex_};
+
+        if (!valid_)
+        {
+            return RESULT_FAIL_NO_DATA;
+        }
+
+        std::memcpy(&data, &latest_.data, sizeof(TData));
+        return RESULT_SUCCESS;
+    }
+
+    // Saves to the first idle shard, starting from a different shard on each
+    // call. Only blocks if every shard is busy.
+    Result Save(const TData& data)
+    {
+        {
+            std::lock_guard<std::mutex> lock{latest_mutex_};
+
+            if (valid_ && 0 == std::memcmp(&latest_.data, &data, sizeof(TData)))
+            {
+                return RESULT_SUCCESS;
+            }
+        }
+
+        Record record;
+        record.generation =
+            generation_.fetch_add(1, std::memory_order_relaxed) + 1;
+        std::memcpy(&record.data, &data, sizeof(TData));
+
+        uint32_t first = record.generation % num_shards;
+        std::unique_lock<std::mutex> lock;
+        uint32_t shard_n = first;
+
+        for (uint32_t i = 0; i < num_shards; i++)
+        {
+            shard_n = (first + i) % num_shards;
+            lock = std::unique_lock<std::mutex>{mutexes_[shard_n],
+                std::try_to_lock};
+
+            if (lock.owns_lock())
+            {
+                break;
+            }
+        }
+
+        if (!lock.owns_lock())
+        {
+            shard_n = first;
+            lock = std::unique_lock<std::mutex>{mutexes_[shard_n]};
+        }
+
+        Result result = shards_[shard_n].Save(record);
+        lock.unlock();
+
+        if (result == RESULT_SUCCESS)
+        {
+            std::lock_guard<std::mutex> latest_lock{latest_mutex_};
+
+            if (!valid_ || record.generation > latest_.generation)
+            {
+                latest_ = record;
+                valid_ = true;
+            }
+        }
+
+        return result;
+    }
+
+protected:
+    static_assert(num_shards > 0);
+
+    struct Record
+    {
+        uint64_t generation;
+        TData data;
+    };
+
+    static constexpr uint32_t kShardSize =
+        NVMem::kSize / num_shards / NVMem::kEraseGranularity *
+        NVMem::kEraseGranularity;
+
+    using Region = NVMemRegion<NVMem, kShardSize>;
+    using Shard = Persist<Region, Record, datatype_version,
+        assert_fault_tolerant>;
+
+    Region regions_[num_shards];
+    Shard shards_[num_shards];
+    std::mutex mutexes_[num_shards];
+    std::mutex latest_mutex_;
+    std::atomic<uint64_t> generation_{0};
+    Record latest_;
+    bool valid_ = false;
+
+    template <size_t... I>
+    ShardedPersist(NVMem& nvmem, std::index_sequence<I...>) :
+        regions_{Region{nvmem, I * kShardSize}...},
+        shards_{Shard{regions_[I]}...}
+    {}
+};
+
+}
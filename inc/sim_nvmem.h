@@ -0,0 +1,358 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+#include <vector>
+
+namespace persist
+{
+
+// RAM-backed simulation of NOR flash for hosted platforms, implementing the
+// NVMem interface described in nvmem_template.h. Erasing sets bytes to
+// `fill_byte` and writing can only clear bits, as with real flash. Operations
+// which are misaligned or out of bounds fail. Every operation is counted, as
+// is the number of times each erase granule has been erased. Operations on
+// disjoint ranges may be made from several threads at once, as by
+// ParallelPersist or ShardedPersist, since the counters are atomic.
+//
+// Writes always behave as reprogramming, but kSupportsReprogram is only
+// advertised if `supports_reprogram` is set.
+template <uint32_t size, uint32_t erase_granularity, uint32_t write_granularity,
+    uint8_t fill_byte = 0xFF, bool supports_reprogram = false>
+class SimNVMem
+{
+public:
+    static constexpr uint32_t kSize = size;
+    static constexpr uint32_t kEraseGranularity = erase_granularity;
+    static constexpr uint32_t kWriteGranularity = write_granularity;
+    static constexpr uint8_t kFillByte = fill_byte;
+    static constexpr bool kSupportsReprogram = supports_reprogram;
+    static constexpr uint32_t kNumGranules = size / erase_granularity;
+
+    static_assert(size % erase_granularity == 0);
+
+    struct Counters
+    {
+        uint64_t reads;
+        uint64_t writes;
+        uint64_t erases;
+        uint64_t bytes_read;
+        uint64_t bytes_written;
+        uint64_t bytes_erased;
+    };
+
+    SimNVMem() :
+        mem_(size, fill_byte),
+        erase_counts_(kNumGranules, 0)
+    {}
+
+    bool Read(void* dst, uint32_t location, uint32_t length)
+    {
+        if (!InBounds(location, length))
+        {
+            return false;
+        }
+
+        counters_.reads.fetch_add(1, std::memory_order_relaxed);
+        counters_.bytes_read.fetch_add(length, std::memory_order_relaxed);
+        std::memcpy(dst, &mem_[location], length);
+        return true;
+    }
+
+    bool Writable(uint32_t location, uint32_t length)
+    {
+        if (!InBounds(location, length))
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            if (mem_[location + i] != fill_byte)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Write(uint32_t location, const void* src, uint32_t length)
+    {
+        if (!InBounds(location, length) || location % write_granularity ||
+            length % write_granularity)
+        {
+            return false;
+        }
+
+        counters_.writes.fetch_add(1, std::memory_order_relaxed);
+        counters_.bytes_written.fetch_add(length, std::memory_order_relaxed);
+        auto byte = reinterpret_cast<const uint8_t*>(src);
+
+        for (uint32_t i = 0; i < length; i++)
+        {
+            mem_[location + i] = Program(mem_[location + i], byte[i]);
+        }
+
+        return true;
+    }
+
+    bool Erase(uint32_t location, uint32_t length)
+    {
+        if (!InBounds(location, length) || location % erase_granularity ||
+            length % erase_granularity)
+        {
+            return false;
+        }
+
+        counters_.erases.fetch_add(1, std::memory_order_relaxed);
+        counters_.bytes_erased.fetch_add(length, std::memory_order_relaxed);
+        std::memset(&mem_[location], fill_byte, length);
+
+        for (uint32_t i = 0; i < length / erase_granularity; i++)
+        {
+            erase_counts_[location / erase_granularity + i]++;
+        }
+
+        return true;
+    }
+
+    // Returns a snapshot of the operation counts.
+    Counters counters(void) const
+    {
+        return Counters{
+            counters_.reads.load(std::memory_order_relaxed),
+            counters_.writes.load(std::memory_order_relaxed),
+            counters_.erases.load(std::memory_order_relaxed),
+            counters_.bytes_read.load(std::memory_order_relaxed),
+            counters_.bytes_written.load(std::memory_order_relaxed),
+            counters_.bytes_erased.load(std::memory_order_relaxed)};
+    }
+
+    // Number of times each erase granule has been erased.
+    const std::vector<uint32_t>& erase_counts(void) const
+    {
+        return erase_counts_;
+    }
+
+    // Direct access to the simulated memory contents.
+    uint8_t* data(void)
+    {
+        return mem_.data();
+    }
+
+protected:
+    struct AtomicCounters
+    {
+        std::atomic<uint64_t> reads{0};
+        std::atomic<uint64_t> writes{0};
+        std::atomic<uint64_t> erases{0};
+        std::atomic<uint64_t> bytes_read{0};
+        std::atomic<uint64_t> bytes_written{0};
+        std::atomic<uint64_t> bytes_erased{0};
+    };
+
+    std::vector<uint8_t> mem_;
+    std::vector<uint32_t> erase_counts_;
+    AtomicCounters counters_;
+
+    static bool InBounds(uint32_t location, uint32_t length)
+    {
+        return location <= size && length <= size - location;
+    }
+
+    // Bits may only be changed away from their erased state.
+    static uint8_t Program(uint8_t old_byte, uint8_t new_byte)
+    {
+        return (fill_byte == 0xFF) ? (old_byte & new_byte) :
+            (old_byte | new_byte);
+    }
+};
+
+// SimNVMem with a virtual clock and a timing model in which Erase() only
+// starts the erase and returns, as it would with a non-blocking driver. A
+// read or write issued while the erase is running waits for it to finish,
+// unless `erase_suspend` is set, in which case the SuspendErase() and
+// ResumeErase() capability is provided and a suspended erase lets reads
+// through after `suspend_ns`. The time taken by each Read() or Writable()
+// call, including any wait or suspend, is recorded in read_latency().
+template <uint32_t size, uint32_t erase_granularity, uint32_t write_granularity,
+    bool erase_suspend, uint8_t fill_byte = 0xFF>
+class TimedSimNVMem :
+    public SimNVMem<size, erase_granularity, write_granularity, fill_byte>
+{
+public:
+    using Base = SimNVMem<size, erase_granularity, write_granularity,
+        fill_byte>;
+
+    // Typical serial NOR flash timings.
+    struct Timing
+    {
+        uint64_t read_ns_per_byte = 20;
+        uint64_t write_ns_per_byte = 3000;
+        uint64_t erase_ns_per_granule = 45000000;
+        uint64_t suspend_ns = 20000;
+    };
+
+    struct Latency
+    {
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+    };
+
+    Timing timing;
+
+    bool Read(void* dst, uint32_t location, uint32_t length)
+    {
+        uint64_t start = BeginRead();
+        bool success = Base::Read(dst, location, length);
+        EndRead(start, length);
+        return success;
+    }
+
+    bool Writable(uint32_t location, uint32_t length)
+    {
+        uint64_t start = BeginRead();
+        bool writable = Base::Writable(location, length);
+        EndRead(start, length);
+        return writable;
+    }
+
+    bool Write(uint32_t location, const void* src, uint32_t length)
+    {
+        WaitForErase();
+        now_ns_ += timing.write_ns_per_byte * length;
+        return Base::Write(location, src, length);
+    }
+
+    bool Erase(uint32_t location, uint32_t length)
+    {
+        WaitForErase();
+
+        if (!Base::Erase(location, length))
+        {
+            return false;
+        }
+
+        erase_end_ns_ = now_ns_ +
+            timing.erase_ns_per_granule * (length / erase_granularity);
+        return true;
+    }
+
+    template <bool E = erase_suspend, std::enable_if_t<E, bool> = true>
+    bool SuspendErase(void)
+    {
+        if (suspended_ || now_ns_ >= erase_end_ns_)
+        {
+            return false;
+        }
+
+        suspend_start_ns_ = now_ns_;
+        now_ns_ += timing.suspend_ns;
+        erase_remaining_ns_ = (erase_end_ns_ > now_ns_) ?
+            (erase_end_ns_ - now_ns_) : 0;
+        suspended_ = true;
+        return true;
+    }
+
+    template <bool E = erase_suspend, std::enable_if_t<E, bool> = true>
+    void ResumeErase(void)
+    {
+        erase_end_ns_ = now_ns_ + erase_remaining_ns_;
+        suspended_ = false;
+    }
+
+    // Let time pass without accessing the memory, e.g. while the application
+    // does other work. A running erase progresses in the meantime.
+    void Idle(uint64_t ns)
+    {
+        now_ns_ += ns;
+    }
+
+    bool erasing(void) const
+    {
+        return now_ns_ < erase_end_ns_;
+    }
+
+    uint64_t now_ns(void) const
+    {
+        return now_ns_;
+    }
+
+    const Latency& read_latency(void) const
+    {
+        return read_latency_;
+    }
+
+    void ClearReadLatency(void)
+    {
+        read_latency_ = {};
+    }
+
+protected:
+    uint64_t now_ns_ = 0;
+    uint64_t erase_end_ns_ = 0;
+    uint64_t erase_remaining_ns_ = 0;
+    uint64_t suspend_start_ns_ = 0;
+    bool suspended_ = false;
+    Latency read_latency_ = {};
+
+    void WaitForErase(void)
+    {
+        if (!suspended_ && now_ns_ < erase_end_ns_)
+        {
+            now_ns_ = erase_end_ns_;
+        }
+    }
+
+    // A read issued just after SuspendErase() is charged for the suspend.
+    uint64_t BeginRead(void)
+    {
+        if (suspended_)
+        {
+            uint64_t start = suspend_start_ns_;
+            suspend_start_ns_ = now_ns_;
+            return start;
+        }
+
+        WaitForErase();
+        return now_ns_;
+    }
+
+    void EndRead(uint64_t start, uint32_t length)
+    {
+        now_ns_ += timing.read_ns_per_byte * length;
+        uint64_t elapsed = now_ns_ - start;
+        read_latency_.count++;
+        read_latency_.total_ns += elapsed;
+        read_latency_.max_ns =
+            (elapsed > read_latency_.max_ns) ? elapsed : read_latency_.max_ns;
+    }
+};
+
+}
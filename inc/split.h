@@ -0,0 +1,165 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "../persist.h"
+#include "region.h"
+
+namespace persist
+{
+
+// Lists the frequently changed data members of TData for SplitPersist, e.g.
+// `HotFields<&MyData::volume, &MyData::mode>`.
+template <auto... members>
+struct HotFields
+{
+    static_assert(sizeof...(members) > 0);
+
+    // Compares only the members not listed.
+    using ColdEquality = IgnoreFields<members...>;
+
+    template <typename T, typename M>
+    static constexpr uint32_t MemberSize(M T::*)
+    {
+        return sizeof(M);
+    }
+
+    static constexpr uint32_t kSize = (MemberSize(members) + ...);
+
+    // Copies the listed members of `data` to `dst`, back-to-back.
+    template <typename TData>
+    static void Gather(uint8_t* dst, const TData& data)
+    {
+        ((std::memcpy(dst, &(data.*members), sizeof(data.*members)),
+            dst += sizeof(data.*members)), ...);
+    }
+
+    // Copies the listed members from `src` into `data`.
+    template <typename TData>
+    static void Scatter(TData& data, const uint8_t* src)
+    {
+        ((std::memcpy(&(data.*members), src, sizeof(data.*members)),
+            src += sizeof(data.*members)), ...);
+    }
+};
+
+// Persist for Data which mixes rarely changed fields, such as calibration,
+// with a few frequently changed ones. The first `hot_size` bytes of the memory
+// hold a region for the `Hot` fields (see HotFields) and the rest hold a
+// region for the whole Data, each managed by an independent Persist. A save
+// which changes only hot fields writes just those, so its cost doesn't depend
+// on the size of the Data.
+//
+// A save which changes any other field writes the whole Data, including the
+// hot fields, to the cold region and then the hot fields to the hot region.
+// Each hot record notes the sequence number of the cold data it accompanies;
+// if the two don't match because power was lost in between, Load() returns
+// the cold data alone, which is complete. Load() therefore always returns the
+// Data passed to a single Save().
+//
+// `hot_size` must be a multiple of NVMem's erase granularity.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    uint32_t hot_size, typename Hot, bool assert_fault_tolerant = true>
+class SplitPersist
+{
+public:
+    SplitPersist(NVMem& nvmem) :
+        hot_region_{nvmem, 0},
+        cold_region_{nvmem, hot_size},
+        hot_{hot_region_},
+        cold_{cold_region_}
+    {}
+
+    Result Init(void)
+    {
+        Result result = cold_.Init();
+        return (result == RESULT_SUCCESS) ? hot_.Init() : result;
+    }
+
+    Result Load(TData& data)
+    {
+        Result result = cold_.Load(data);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        HotRecord record;
+
+        if (hot_.Load(record) == RESULT_SUCCESS &&
+            record.cold_sequence == cold_.sequence())
+        {
+            Hot::Scatter(data, record.fields);
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    // The cold region is written only if a field other than the hot fields
+    // has changed.
+    Result Save(const TData& data)
+    {
+        Result result = cold_.Save(data);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        HotRecord record;
+        Hot::Gather(record.fields, data);
+        record.cold_sequence = cold_.sequence();
+        return hot_.Save(record);
+    }
+
+    Result Format(void)
+    {
+        Result result = cold_.Format();
+        return (result == RESULT_SUCCESS) ? hot_.Format() : result;
+    }
+
+protected:
+    static_assert(hot_size % NVMem::kEraseGranularity == 0);
+    static_assert(hot_size < NVMem::kSize);
+
+    struct __attribute__ ((packed)) HotRecord
+    {
+        uint8_t fields[Hot::kSize];
+        uint16_t cold_sequence;
+    };
+
+    using HotRegion = NVMemRegion<NVMem, hot_size>;
+    using ColdRegion = NVMemRegion<NVMem, NVMem::kSize - hot_size>;
+
+    HotRegion hot_region_;
+    ColdRegion cold_region_;
+    Persist<HotRegion, HotRecord, datatype_version, assert_fault_tolerant>
+        hot_;
+    Persist<ColdRegion, TData, datatype_version, assert_fault_tolerant,
+        NullStats, NullTracer, PackedLayout, typename Hot::ColdEquality> cold_;
+};
+
+}
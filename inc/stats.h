@@ -0,0 +1,148 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+
+namespace persist
+{
+
+// Statistics policies for Persist. A policy provides a class template
+// Recorder<num_pages> which Persist instantiates as a member and notifies of
+// each operation.
+
+// Default policy. Records nothing, and all of its calls compile to nothing.
+struct NullStats
+{
+    template <uint32_t num_pages>
+    struct Recorder
+    {
+        static constexpr bool kEnabled = false;
+
+        static uint32_t Now(void) { return 0; }
+        void InitDone(uint32_t) {}
+        void LoadDone(uint32_t) {}
+        void SaveDone(uint32_t) {}
+        void SaveRequested(void) {}
+        void SaveSuppressed(void) {}
+        void SaveDeferred(void) {}
+        void SaveCoalesced(void) {}
+        void BudgetOverdrawn(void) {}
+        void BudgetBalance(int32_t) {}
+        void BlockWritten(void) {}
+        void BlockOverwritten(void) {}
+        void PageErased(uint32_t) {}
+        void MountScanned(uint32_t, uint32_t) {}
+    };
+};
+
+// Records operation counts, erase counts per page, and latency histograms.
+// `Clock` must provide a function `static uint32_t Now(void)` which returns a
+// free-running timestamp in any unit, e.g. microseconds or CPU cycles.
+//
+// The recorder consists only of integers and arrays thereof, so it may be
+// copied as-is into a telemetry packet.
+template <typename Clock>
+struct Stats
+{
+    // Bucket i counts latencies in the range [2^i, 2^(i+1)) ticks, except for
+    // the first bucket which also counts zero and the last bucket which counts
+    // everything larger. Bucket counts saturate.
+    struct Histogram
+    {
+        static constexpr uint32_t kNumBuckets = 16;
+
+        uint32_t count;
+        uint32_t max;
+        uint16_t buckets[kNumBuckets];
+
+        static uint32_t Bucket(uint32_t latency)
+        {
+            uint32_t bucket = 0;
+
+            while (bucket < kNumBuckets - 1 && (latency >> (bucket + 1)))
+            {
+                bucket++;
+            }
+
+            return bucket;
+        }
+
+        void Add(uint32_t latency)
+        {
+            uint32_t bucket = Bucket(latency);
+            count++;
+            max = (latency > max) ? latency : max;
+            buckets[bucket] += (buckets[bucket] != UINT16_MAX);
+        }
+    };
+
+    template <uint32_t num_pages>
+    struct Recorder
+    {
+        static constexpr bool kEnabled = true;
+
+        uint32_t saves_requested;
+        uint32_t saves_suppressed;
+        uint32_t saves_deferred;
+        uint32_t saves_coalesced;
+        uint32_t budget_overdrafts;
+        int32_t budget_balance;
+        uint32_t blocks_written;
+        uint32_t blocks_overwritten;
+        uint32_t pages_erased;
+        uint32_t blocks_read;
+        uint32_t crc_failures;
+        Histogram init_latency;
+        Histogram save_latency;
+        Histogram load_latency;
+        uint32_t page_erases[num_pages];
+
+        static uint32_t Now(void) { return Clock::Now(); }
+        void InitDone(uint32_t start) { init_latency.Add(Now() - start); }
+        void LoadDone(uint32_t start) { load_latency.Add(Now() - start); }
+        void SaveDone(uint32_t start) { save_latency.Add(Now() - start); }
+        void SaveRequested(void) { saves_requested++; }
+        void SaveSuppressed(void) { saves_suppressed++; }
+        void SaveDeferred(void) { saves_deferred++; }
+        void SaveCoalesced(void) { saves_coalesced++; }
+        void BudgetOverdrawn(void) { budget_overdrafts++; }
+        void BudgetBalance(int32_t saves) { budget_balance = saves; }
+        void BlockWritten(void) { blocks_written++; }
+        void BlockOverwritten(void) { blocks_overwritten++; }
+
+        void PageErased(uint32_t page_n)
+        {
+            pages_erased++;
+            page_erases[page_n]++;
+        }
+
+        void MountScanned(uint32_t num_blocks_read, uint32_t num_crc_failures)
+        {
+            blocks_read += num_blocks_read;
+            crc_failures += num_crc_failures;
+        }
+    };
+};
+
+}
@@ -0,0 +1,245 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Wear budget enforced by ThrottledPersist. Fields which are zero are taken as
+// one.
+struct WearBudget
+{
+    // Erase cycles for which each erase granule of the memory is rated.
+    uint32_t endurance;
+
+    // Required lifetime of the device in days.
+    uint32_t lifetime_days;
+
+    // Number of saves which may be made at once when the budget has not
+    // recently been used.
+    uint32_t burst;
+};
+
+// Persist which limits the rate of saves so that the memory lasts for the
+// required lifetime. Every erase granule in the region is erased once per
+// kNumBlocks saves, so the budget allows `endurance` times kNumBlocks saves
+// over `lifetime_days`, i.e. endurance / lifetime_days erases of each page per
+// day. Unused budget accumulates up to `burst` saves.
+//
+// When the budget is exhausted, Save() keeps the data in RAM and returns
+// RESULT_DEFERRED. Further saves replace the deferred data, and Flush(), which
+// should be called periodically, writes the latest of them once enough budget
+// has accumulated. Load() returns the deferred data, if any. Saves of data
+// equal to that already saved are free.
+//
+// `Clock` must provide a function `static uint32_t Now(void)` which returns a
+// monotonic time in seconds. The budget is kept in RAM, so after a restart the
+// full burst is available again.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    typename Clock, bool assert_fault_tolerant = true,
+    typename StatsPolicy = NullStats, typename Tracer = NullTracer,
+    typename Layout = PackedLayout, typename Equality = BytewiseEqual>
+class ThrottledPersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer, Layout, Equality>
+{
+public:
+    ThrottledPersist(NVMem& nvmem, const WearBudget& budget) :
+        Base{nvmem},
+        rate_{uint64_t{std::max(budget.endurance, 1u)} * Base::kNumBlocks},
+        cost_{int64_t{kSecondsPerDay} * std::max(budget.lifetime_days, 1u)},
+        capacity_{cost_ * std::max(budget.burst, 1u)},
+        credit_{capacity_}
+    {}
+
+    Result Init(void)
+    {
+        pending_ = false;
+        last_refill_ = Clock::Now();
+        return Base::Init();
+    }
+
+    Result Load(TData& data)
+    {
+        if (pending_)
+        {
+            std::memcpy(&data, &pending_data_, sizeof(TData));
+            return RESULT_SUCCESS;
+        }
+
+        return Base::Load(data);
+    }
+
+    Result Save(const TData& data)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_SAVE, 0, sizeof(TData));
+        this->stats_.SaveRequested();
+        Result result = RESULT_SUCCESS;
+
+        if (this->DataIsSame(data))
+        {
+            pending_ = false;
+            this->stats_.SaveSuppressed();
+        }
+        else if (Refill() >= cost_)
+        {
+            result = Commit(data);
+        }
+        else
+        {
+            if (pending_)
+            {
+                this->stats_.SaveCoalesced();
+            }
+            else
+            {
+                this->stats_.SaveDeferred();
+            }
+
+            std::memcpy(&pending_data_, &data, sizeof(TData));
+            pending_ = true;
+            result = RESULT_DEFERRED;
+            this->stats_.BudgetBalance(Balance());
+        }
+
+        this->tracer_.End(TRACE_SAVE, result == RESULT_SUCCESS);
+        this->stats_.SaveDone(start);
+        return result;
+    }
+
+    // Writes the deferred data, if any, once the budget allows. Returns
+    // RESULT_DEFERRED if it must wait longer. If `ignore_budget` is true, e.g.
+    // before a planned shutdown, the data is written regardless and the budget
+    // is overdrawn.
+    Result Flush(bool ignore_budget = false)
+    {
+        if (!pending_)
+        {
+            return RESULT_SUCCESS;
+        }
+
+        // Writing data equal to that saved would program nothing, so it must
+        // not be charged.
+        if (this->DataIsSame(pending_data_))
+        {
+            pending_ = false;
+            return RESULT_SUCCESS;
+        }
+
+        if (Refill() < cost_ && !ignore_budget)
+        {
+            return RESULT_DEFERRED;
+        }
+
+        return Commit(pending_data_);
+    }
+
+    bool SavePending(void) const
+    {
+        return pending_;
+    }
+
+    // Saves allowed per day by the budget.
+    double SavesPerDay(void) const
+    {
+        return double(rate_) * kSecondsPerDay / cost_;
+    }
+
+    // Saves which may be made now without being deferred. Negative if the
+    // budget has been overdrawn.
+    double Available(void)
+    {
+        return double(Refill()) / cost_;
+    }
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer, Layout, Equality>;
+
+    static constexpr uint32_t kSecondsPerDay = 86400;
+
+    // Credit is measured in units of 1 / cost_ saves, and accrues by rate_
+    // units per second.
+    uint64_t rate_;
+    int64_t cost_;
+    int64_t capacity_;
+    int64_t credit_;
+    uint32_t last_refill_ = 0;
+    bool pending_ = false;
+    TData pending_data_;
+
+    int64_t Refill(void)
+    {
+        uint32_t now = Clock::Now();
+        uint32_t elapsed = now - last_refill_;
+        last_refill_ = now;
+
+        // Saturate before multiplying, so that long idle periods don't
+        // overflow.
+        int64_t deficit = capacity_ - credit_;
+
+        if (deficit > 0)
+        {
+            credit_ = (elapsed >= uint64_t(deficit) / rate_ + 1) ? capacity_ :
+                credit_ + int64_t(elapsed * rate_);
+            credit_ = (credit_ > capacity_) ? capacity_ : credit_;
+        }
+
+        return credit_;
+    }
+
+    // Writes `data` and charges the budget. `data` must differ from that
+    // already saved, so that a block is programmed.
+    Result Commit(const TData& data)
+    {
+        if (credit_ < cost_)
+        {
+            this->stats_.BudgetOverdrawn();
+        }
+
+        Result result = Base::WriteBlock(data);
+
+        if (result == RESULT_SUCCESS)
+        {
+            credit_ -= cost_;
+            pending_ = false;
+        }
+
+        this->stats_.BudgetBalance(Balance());
+        return result;
+    }
+
+    // Whole saves left in the budget, rounded down so an overdraft of any
+    // size is negative.
+    int32_t Balance(void) const
+    {
+        return int32_t((credit_ < 0 ? credit_ - cost_ + 1 : credit_) / cost_);
+    }
+};
+
+}
@@ -0,0 +1,195 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Persist over two memories: a small, fast one such as FRAM or EEPROM, and a
+// large, slow one such as flash. The slow tier holds a base copy of the Data,
+// and each save writes a journal entry to the fast tier holding the range of
+// bytes in which the Data differs from the base, up to `journal_size` bytes.
+// When the range would be larger, or on Flush(), the Data is folded into a new
+// base on the slow tier instead. Most saves therefore cost one small write to
+// the fast tier, and the slow tier is written only as often as the Data
+// drifts far from the base.
+//
+// Each entry records the sequence number of the base it applies to. A fold
+// writes the base and then an empty entry; if power is lost in between, the
+// previous entry no longer matches the base and is ignored, so Load() returns
+// the Data from the most recent save in either case.
+template <typename FastNVMem, typename SlowNVMem, typename TData,
+    uint8_t datatype_version, uint32_t journal_size,
+    bool assert_fault_tolerant = true>
+class TieredPersist
+{
+public:
+    TieredPersist(FastNVMem& fast, SlowNVMem& slow) :
+        fast_{fast},
+        slow_{slow}
+    {}
+
+    Result Init(void)
+    {
+        base_valid_ = false;
+        Result result = slow_.Init();
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        result = fast_.Init();
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        base_valid_ = (slow_.Load(base_) == RESULT_SUCCESS);
+        return RESULT_SUCCESS;
+    }
+
+    Result Load(TData& data)
+    {
+        if (!base_valid_)
+        {
+            return RESULT_FAIL_NO_DATA;
+        }
+
+        std::memcpy(&data, &base_, sizeof(TData));
+        Entry entry;
+
+        if (fast_.Load(entry) == RESULT_SUCCESS && Applies(entry))
+        {
+            std::memcpy(reinterpret_cast<uint8_t*>(&data) + entry.offset,
+                entry.bytes, entry.length);
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    Result Save(const TData& data)
+    {
+        if (!base_valid_)
+        {
+            return Fold(data);
+        }
+
+        auto base = reinterpret_cast<const uint8_t*>(&base_);
+        auto byte = reinterpret_cast<const uint8_t*>(&data);
+        uint32_t first = sizeof(TData);
+        uint32_t last = 0;
+
+        for (uint32_t i = 0; i < sizeof(TData); i++)
+        {
+            if (base[i] != byte[i])
+            {
+                first = std::min(first, i);
+                last = i + 1;
+            }
+        }
+
+        if (first < last && last - first > journal_size)
+        {
+            return Fold(data);
+        }
+
+        Entry entry = {};
+        entry.base_sequence = slow_.sequence();
+
+        if (first < last)
+        {
+            entry.offset = first;
+            entry.length = last - first;
+            std::memcpy(entry.bytes, byte + first, entry.length);
+        }
+
+        return fast_.Save(entry);
+    }
+
+    // Folds the journal into a new base on the slow tier, e.g. before the
+    // fast tier is replaced or to keep a complete copy on the slow tier.
+    Result Flush(void)
+    {
+        TData data;
+        Result result = Load(data);
+        return (result == RESULT_SUCCESS) ? Fold(data) : RESULT_SUCCESS;
+    }
+
+    Result Format(void)
+    {
+        base_valid_ = false;
+        Result result = slow_.Format();
+        return (result == RESULT_SUCCESS) ? fast_.Format() : result;
+    }
+
+protected:
+    static_assert(journal_size > 0);
+    static_assert(sizeof(TData) <= UINT16_MAX);
+
+    struct __attribute__ ((packed)) Entry
+    {
+        uint16_t base_sequence;
+        uint16_t offset;
+        uint16_t length;
+        uint8_t bytes[journal_size];
+    };
+
+    Persist<FastNVMem, Entry, datatype_version, assert_fault_tolerant> fast_;
+    Persist<SlowNVMem, TData, datatype_version, assert_fault_tolerant> slow_;
+    TData base_;
+    bool base_valid_ = false;
+
+    bool Applies(const Entry& entry) const
+    {
+        return entry.base_sequence == slow_.sequence() &&
+            entry.length <= journal_size &&
+            entry.offset + entry.length <= sizeof(TData);
+    }
+
+    // Writes `data` as the new base, then an empty entry for it.
+    Result Fold(const TData& data)
+    {
+        Result result = slow_.Save(data);
+
+        // A failed write may nonetheless have taken effect.
+        base_valid_ = (slow_.Load(base_) == RESULT_SUCCESS);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        Entry entry = {};
+        entry.base_sequence = slow_.sequence();
+        return fast_.Save(entry);
+    }
+};
+
+}
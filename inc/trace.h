@@ -0,0 +1,76 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+
+namespace persist
+{
+
+enum TraceEvent
+{
+    TRACE_READ,
+    TRACE_WRITABLE,
+    TRACE_WRITE,
+    TRACE_ERASE,
+    TRACE_SCAN,
+    TRACE_PAGE_ROLLOVER,
+    TRACE_CRC_MISMATCH,
+    TRACE_SAVE,
+    TRACE_MOUNT,
+    TRACE_CRC,
+    TRACE_COMPARE,
+    TRACE_COPY,
+};
+
+constexpr uint32_t kNumTraceEvents = TRACE_COPY + 1;
+
+// Tracers are notified by Persist around each NVMem operation and at notable
+// state transitions:
+//
+// - Begin() and End() bracket the NVMem operations TRACE_READ, TRACE_WRITABLE,
+//   TRACE_WRITE and TRACE_ERASE, and the scan of a block range for the newest
+//   block, TRACE_SCAN. `location` and `size` are in bytes for NVMem operations
+//   and in blocks for scans. `success` is the result of the operation.
+// - Begin() and End() also bracket the phases of Save() and Init(): the whole
+//   of each, TRACE_SAVE and TRACE_MOUNT, and within them each CRC calculation,
+//   TRACE_CRC, data comparison, TRACE_COMPARE, and data copy, TRACE_COPY.
+//   `location` is 0 and `size` is the number of bytes processed, or blocks for
+//   TRACE_MOUNT. For TRACE_COMPARE, `success` is true if the data was equal.
+// - Mark() reports TRACE_PAGE_ROLLOVER with the number of the page about to be
+//   erased, and TRACE_CRC_MISMATCH with the number of a scanned block which is
+//   neither valid nor blank.
+//
+// A tracer used with ParallelPersist must be thread-safe.
+
+// Default tracer. All of its calls compile to nothing.
+struct NullTracer
+{
+    static constexpr bool kEnabled = false;
+
+    void Begin(TraceEvent, uint32_t, uint32_t) {}
+    void End(TraceEvent, bool) {}
+    void Mark(TraceEvent, uint32_t) {}
+};
+
+}
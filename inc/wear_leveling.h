@@ -0,0 +1,450 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include "../persist.h"
+
+namespace persist
+{
+
+// State of each page offered to a page selection policy.
+struct PageState
+{
+    static constexpr uint32_t kBlank = UINT32_MAX;
+
+    // Number of times the page has been erased.
+    uint32_t erase_count;
+
+    // Number of saves made since the newest valid block in the page was
+    // written, or kBlank if it holds no valid block.
+    uint32_t age;
+
+    // False if the page may not be erased because it holds the newest block or
+    // the block most recently written.
+    bool eligible;
+};
+
+// Page selection policies choose which eligible page WearLevelingPersist
+// erases next. `current` is the page most recently written, or the last page
+// if none has been. At least one page is always eligible; if none would be,
+// the policy is not consulted.
+
+// Erases pages in order, as Persist does.
+struct NextPagePolicy
+{
+    template <size_t num_pages>
+    static uint32_t Select(uint32_t current,
+        const std::array<PageState, num_pages>& pages)
+    {
+        uint32_t page = current;
+
+        do
+        {
+            page = (page + 1) % num_pages;
+        }
+        while (!pages[page].eligible);
+
+        return page;
+    }
+};
+
+// Erases the least-worn page, preferring the one holding the oldest blocks
+// among equally worn pages.
+struct LeastWornPagePolicy
+{
+    template <size_t num_pages>
+    static uint32_t Select(uint32_t current,
+        const std::array<PageState, num_pages>& pages)
+    {
+        int32_t best = -1;
+
+        for (uint32_t i = 1; i <= num_pages; i++)
+        {
+            uint32_t page = (current + i) % num_pages;
+            const PageState& state = pages[page];
+
+            if (state.eligible && (best == -1 ||
+                state.erase_count < pages[best].erase_count ||
+                (state.erase_count == pages[best].erase_count &&
+                state.age > pages[best].age)))
+            {
+                best = page;
+            }
+        }
+
+        return best;
+    }
+};
+
+// Header at the start of each page of WearLevelingPersist.
+template <typename NVMem>
+struct __attribute__ ((packed)) WearLevelingHeader
+{
+    static constexpr uint32_t kUnpaddedSize =
+        sizeof(uint32_t) + sizeof(uint16_t);
+
+    uint32_t erase_count;
+    uint16_t crc;
+    uint8_t padding[(NVMem::kWriteGranularity -
+        kUnpaddedSize % NVMem::kWriteGranularity) % NVMem::kWriteGranularity];
+};
+
+// Persist which chooses the page to erase for subsequent saves according to
+// `PagePolicy`, rather than always taking the next one. Each page begins with a
+// header holding the number of times it has been erased, written just after
+// the erase. A page whose header is missing or corrupt, including a blank page
+// whose header was never written because power was lost after the erase, is
+// assumed to be as worn as the most-worn page.
+//
+// Pages may be skipped for some time, leaving their blocks valid. Mount still
+// finds the newest block because no valid block is allowed to fall more than
+// half the sequence number space behind the newest: a page whose blocks would
+// otherwise do so is erased next, regardless of the policy, unless a page
+// which has never been written remains. The larger the region, the less often
+// the policy has a free choice; with the largest regions, pages are erased in
+// order.
+//
+// Arm() and EmergencySave() are not available.
+template <typename NVMem, typename TData, uint8_t datatype_version,
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename PagePolicy = LeastWornPagePolicy,
+    typename Equality = BytewiseEqual>
+class WearLevelingPersist : public Persist<NVMem, TData, datatype_version,
+    assert_fault_tolerant, StatsPolicy, Tracer,
+    PageHeaderLayout<Layout, sizeof(WearLevelingHeader<NVMem>)>, Equality>
+{
+public:
+    WearLevelingPersist(NVMem& nvmem) : Base{nvmem} {}
+
+    Result Init(void)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_MOUNT, 0, Base::kNumBlocks);
+        bool suspended = this->SuspendErase();
+        Result result = Mount();
+        this->ResumeErase(suspended);
+        this->tracer_.End(TRACE_MOUNT, result == RESULT_SUCCESS);
+        this->stats_.InitDone(start);
+        return result;
+    }
+
+    Result Save(const TData& data)
+    {
+        uint32_t start = this->stats_.Now();
+        this->tracer_.Begin(TRACE_SAVE, 0, sizeof(TData));
+        this->stats_.SaveRequested();
+        Result result = RESULT_SUCCESS;
+
+        if (this->DataIsSame(data))
+        {
+            this->stats_.SaveSuppressed();
+        }
+        else
+        {
+            result = WriteBlock(data);
+        }
+
+        this->tracer_.End(TRACE_SAVE, result == RESULT_SUCCESS);
+        this->stats_.SaveDone(start);
+        return result;
+    }
+
+    // Erases every page, keeping count. Must follow Init(). Any saved data is
+    // lost.
+    Result Format(void)
+    {
+        this->active_block_n_ = -1;
+        this->sequence_ = 0;
+        this->ResetWriteState();
+
+        for (uint32_t page = 0; page < Base::kNumPages; page++)
+        {
+            if (ErasePage(page) != RESULT_SUCCESS)
+            {
+                Mount();
+                return RESULT_FAIL_ERASE;
+            }
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    Result Arm(uint32_t stable_size = 0) = delete;
+    Result EmergencySave(const TData& data) = delete;
+
+    // Number of times `page` has been erased, as recorded in its header.
+    uint32_t erase_count(uint32_t page) const
+    {
+        return pages_[page].erase_count;
+    }
+
+protected:
+    using Base = Persist<NVMem, TData, datatype_version, assert_fault_tolerant,
+        StatsPolicy, Tracer,
+        PageHeaderLayout<Layout, sizeof(WearLevelingHeader<NVMem>)>,
+        Equality>;
+
+    static_assert(Base::kNumPages >= 2,
+        "WearLevelingPersist requires at least two pages");
+
+    using TSequenceNum = typename Base::TSequenceNum;
+    using TCRC = typename Base::TCRC;
+    using Header = WearLevelingHeader<NVMem>;
+
+    static constexpr TCRC kHeaderSeed = 0xC5A3;
+
+    // A page is erased regardless of the policy once this many saves have
+    // been made since its newest block. By the time it has been written over,
+    // the oldest blocks of any page fall less than kSequenceWindow behind.
+    static constexpr uint32_t kReclaimAge =
+        (Base::kSequenceWindow > Base::kNumPages * Base::kBlocksPerPage) ?
+        Base::kSequenceWindow - Base::kNumPages * Base::kBlocksPerPage : 0;
+
+    std::array<PageState, Base::kNumPages> pages_ = {};
+
+    // Sequence number of the newest valid block in each page.
+    std::array<TSequenceNum, Base::kNumPages> newest_ = {};
+
+    static uint32_t PageOf(int32_t block_n)
+    {
+        return block_n / Base::kBlocksPerPage;
+    }
+
+    static uint32_t PageEnd(uint32_t page)
+    {
+        return std::min((page + 1) * Base::kBlocksPerPage, Base::kNumBlocks);
+    }
+
+    TCRC GetHeaderCRC(const Header& header)
+    {
+        this->crc_.Seed(kHeaderSeed);
+        return this->crc_.Process(&header.erase_count,
+            sizeof(header.erase_count));
+    }
+
+    // Reads each page's header and finds its newest block, and the newest
+    // block overall.
+    Result Mount(void)
+    {
+        this->crc_.Init();
+        this->active_block_n_ = -1;
+        this->sequence_ = 0;
+        this->ResetWriteState();
+        uint32_t crc_failures = 0;
+        uint32_t max_erase_count = 0;
+
+        for (uint32_t page = 0; page < Base::kNumPages; page++)
+        {
+            Header header;
+            PageState& state = pages_[page];
+            state.age = PageState::kBlank;
+
+            if (!this->ReadMem(&header, page * Base::kPageSize, sizeof(header)))
+            {
+                return RESULT_FAIL_READ;
+            }
+
+            if (header.crc == GetHeaderCRC(header) &&
+                header.erase_count != UINT32_MAX)
+            {
+                state.erase_count = header.erase_count;
+                max_erase_count = std::max(max_erase_count, header.erase_count);
+            }
+            else
+            {
+                state.erase_count = UINT32_MAX;
+            }
+
+            int32_t block_n;
+            TSequenceNum sequence;
+            uint32_t page_crc_failures;
+            Result result = this->FindNewestBlock(page * Base::kBlocksPerPage,
+                PageEnd(page), this->block_, this->crc_, block_n, sequence,
+                page_crc_failures);
+            crc_failures += page_crc_failures;
+
+            if (result != RESULT_SUCCESS)
+            {
+                this->active_block_n_ = -1;
+                this->ResetWriteState();
+                return result;
+            }
+
+            if (block_n != -1)
+            {
+                state.age = 0;
+                newest_[page] = sequence;
+
+                if (this->active_block_n_ == -1 ||
+                    Base::IsNewer(sequence, this->sequence_))
+                {
+                    this->active_block_n_ = block_n;
+                    this->sequence_ = sequence;
+                }
+            }
+        }
+
+        for (PageState& state : pages_)
+        {
+            if (state.erase_count == UINT32_MAX)
+            {
+                state.erase_count = max_erase_count;
+            }
+        }
+
+        this->stats_.MountScanned(Base::kNumBlocks, crc_failures);
+        this->ResetWriteState();
+        return this->ReadActiveBlock();
+    }
+
+    Result WriteBlock(const TData& data)
+    {
+        int32_t block_n = -1;
+
+        // Continue in the current page, skipping blocks which can't be
+        // written, e.g. due to earlier failed writes.
+        if (this->head_block_n_ != -1)
+        {
+            uint32_t end = PageEnd(PageOf(this->head_block_n_));
+
+            for (uint32_t i = this->head_block_n_ + 1; i < end; i++)
+            {
+                if (this->MemWritable(this->BlockLocation(i),
+                    Base::kBlockSize))
+                {
+                    block_n = i;
+                    break;
+                }
+            }
+        }
+
+        if (block_n == -1)
+        {
+            uint32_t page = SelectPage();
+            Result result = ErasePage(page);
+
+            if (result != RESULT_SUCCESS)
+            {
+                return result;
+            }
+
+            block_n = page * Base::kBlocksPerPage;
+        }
+
+        int32_t previous_block_n = this->active_block_n_;
+        TSequenceNum previous_sequence = this->sequence_;
+        TSequenceNum sequence = (previous_block_n == -1) ? 0 :
+            TSequenceNum(previous_sequence + 1);
+        this->armed_block_n_ = -1;
+
+        Equality::Store(this->block_.data, data);
+        std::memset(&this->block_.padding, NVMem::kFillByte,
+            Base::kBlockPaddingSize);
+        this->block_.sequence_n = sequence;
+        this->block_.crc = this->GetCRC(this->block_);
+
+        // The block may be valid even if the write fails.
+        pages_[PageOf(block_n)].age = 0;
+        newest_[PageOf(block_n)] = sequence;
+
+        return this->ProgramBlock(block_n, sequence, previous_block_n,
+            previous_sequence);
+    }
+
+    uint32_t SelectPage(void)
+    {
+        int32_t oldest = -1;
+
+        for (uint32_t page = 0; page < Base::kNumPages; page++)
+        {
+            PageState& state = pages_[page];
+            state.eligible =
+                (this->active_block_n_ == -1 ||
+                page != PageOf(this->active_block_n_)) &&
+                (this->head_block_n_ == -1 ||
+                page != PageOf(this->head_block_n_));
+
+            if (state.age != PageState::kBlank)
+            {
+                state.age = TSequenceNum(this->sequence_ - newest_[page]);
+            }
+
+            // Pages which have never been written count as the oldest, so
+            // that they are filled before any page is reclaimed. Otherwise,
+            // where kReclaimAge is small, reclaims would alternate between
+            // the first pages written.
+            if (state.eligible &&
+                (oldest == -1 || state.age > pages_[oldest].age))
+            {
+                oldest = page;
+            }
+        }
+
+        // Only the newest block's page and a page whose writes have failed
+        // remain, so take the page after the newest block's, as Persist does.
+        if (oldest == -1)
+        {
+            return (PageOf(this->active_block_n_) + 1) % Base::kNumPages;
+        }
+
+        if (pages_[oldest].age >= kReclaimAge)
+        {
+            return oldest;
+        }
+
+        uint32_t current = (this->head_block_n_ == -1) ?
+            Base::kNumPages - 1 : PageOf(this->head_block_n_);
+        return PagePolicy::Select(current, pages_);
+    }
+
+    // Erases `page` and writes its header. The header is advisory, so a
+    // failure to write it is ignored.
+    Result ErasePage(uint32_t page)
+    {
+        this->tracer_.Mark(TRACE_PAGE_ROLLOVER, page);
+
+        if (!this->EraseRange(page * Base::kPageSize, Base::kPageSize))
+        {
+            return RESULT_FAIL_ERASE;
+        }
+
+        this->stats_.PageErased(page);
+        PageState& state = pages_[page];
+        state.erase_count++;
+        state.age = PageState::kBlank;
+
+        Header header;
+        std::memset(&header, NVMem::kFillByte, sizeof(header));
+        header.erase_count = state.erase_count;
+        header.crc = GetHeaderCRC(header);
+        this->WriteMem(page * Base::kPageSize, &header, sizeof(header));
+        return RESULT_SUCCESS;
+    }
+};
+
+}
@@ -0,0 +1,174 @@
+// MIT License
+//
+// Copyright 2023 Tyler Coy
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include "../persist.h"
+
+namespace persist
+{
+
+// Replays saves through Persist on a simulated NVMem, such as SimNVMem, to
+// estimate the wear caused by an application's save pattern. The simulation
+// runs as fast as the host allows, so years of saves can be replayed in
+// seconds.
+//
+// NVMem must provide counters() and erase_counts() as SimNVMem does. TPersist
+// may be any Persist type, or one derived from it, with the same NVMem and
+// TData.
+template <typename NVMem, typename TData, bool assert_fault_tolerant = true,
+    typename TPersist = Persist<NVMem, TData, 0, assert_fault_tolerant>>
+class WearSimulator
+{
+public:
+    struct Report
+    {
+        uint64_t saves;
+        uint64_t saves_changed;
+        uint64_t blocks_written;
+        uint64_t bytes_written;
+        uint64_t bytes_erased;
+        uint32_t min_erases;
+        uint32_t max_erases;
+        double mean_erases;
+
+        // Bytes programmed per byte of changed data saved.
+        double write_amplification;
+
+        // Bytes erased per byte of changed data saved.
+        double erase_amplification;
+
+        // Number of saves with this pattern until the most-worn erase granule
+        // reaches `endurance` erase cycles.
+        double LifetimeSaves(uint32_t endurance) const
+        {
+            return max_erases ?
+                double(saves) * endurance / max_erases :
+                std::numeric_limits<double>::infinity();
+        }
+
+        double LifetimeDays(uint32_t endurance, double saves_per_day) const
+        {
+            return LifetimeSaves(endurance) / saves_per_day;
+        }
+
+        double LifetimeYears(uint32_t endurance, double saves_per_day) const
+        {
+            return LifetimeDays(endurance, saves_per_day) / 365.25;
+        }
+    };
+
+    WearSimulator() : persist_{nvmem_}
+    {
+        persist_.Init();
+    }
+
+    // Saves one record, for replaying a recorded trace of saves.
+    Result Save(const TData& data)
+    {
+        saves_++;
+        uint64_t writes = nvmem_.counters().writes;
+        Result result = persist_.Save(data);
+        saves_changed_ += (nvmem_.counters().writes != writes);
+        return result;
+    }
+
+    // Performs `num_saves` saves. Before each save, `generate(i, data)` is
+    // called to produce the data for the `i`th save, e.g. from a synthetic
+    // distribution of changes.
+    template <typename Generator>
+    Report Run(uint64_t num_saves, Generator&& generate)
+    {
+        TData data{};
+
+        for (uint64_t i = 0; i < num_saves; i++)
+        {
+            generate(i, data);
+            Save(data);
+        }
+
+        return report();
+    }
+
+    // Re-initializes Persist from the simulated memory, as after a reboot.
+    Result Reboot(void)
+    {
+        return persist_.Init();
+    }
+
+    // Erase counts cover only the granules of the region used by Persist,
+    // which may not extend to the end of the memory.
+    Report report(void) const
+    {
+        constexpr LayoutReport kLayout = TPersist::GetLayoutReport();
+        constexpr uint32_t kNumGranules =
+            kLayout.num_pages * kLayout.page_size / NVMem::kEraseGranularity;
+        auto counters = nvmem_.counters();
+        auto first = nvmem_.erase_counts().begin();
+        auto last = first + kNumGranules;
+        double data_bytes = double(saves_changed_) * sizeof(TData);
+
+        Report report;
+        report.saves = saves_;
+        report.saves_changed = saves_changed_;
+        report.blocks_written = counters.writes;
+        report.bytes_written = counters.bytes_written;
+        report.bytes_erased = counters.bytes_erased;
+        report.min_erases = *std::min_element(first, last);
+        report.max_erases = *std::max_element(first, last);
+        report.mean_erases = 0;
+
+        for (auto count = first; count != last; count++)
+        {
+            report.mean_erases += *count;
+        }
+
+        report.mean_erases /= kNumGranules;
+        report.write_amplification =
+            data_bytes ? counters.bytes_written / data_bytes : 0;
+        report.erase_amplification =
+            data_bytes ? counters.bytes_erased / data_bytes : 0;
+        return report;
+    }
+
+    NVMem& nvmem(void)
+    {
+        return nvmem_;
+    }
+
+    TPersist& persist(void)
+    {
+        return persist_;
+    }
+
+protected:
+    NVMem nvmem_;
+    TPersist persist_;
+    uint64_t saves_ = 0;
+    uint64_t saves_changed_ = 0;
+};
+
+}
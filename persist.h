@@ -28,6 +28,11 @@
 #include <algorithm>
 #include <type_traits>
 #include "inc/crc16.h"
+#include "inc/equality.h"
+#include "inc/layout.h"
+#include "inc/nvmem_traits.h"
+#include "inc/stats.h"
+#include "inc/trace.h"
 
 namespace persist
 {
@@ -39,10 +44,15 @@ enum Result
     RESULT_FAIL_ERASE,
     RESULT_FAIL_WRITE,
     RESULT_FAIL_READ,
+    RESULT_FAIL_NOT_ARMED,
+    RESULT_BUSY,
+    RESULT_DEFERRED,
 };
 
 template <typename NVMem, typename TData, uint8_t datatype_version,
-    bool assert_fault_tolerant = true>
+    bool assert_fault_tolerant = true, typename StatsPolicy = NullStats,
+    typename Tracer = NullTracer, typename Layout = PackedLayout,
+    typename Equality = BytewiseEqual>
 class Persist
 {
 public:
@@ -50,76 +60,189 @@ public:
 
     Result Init(void)
     {
+        uint32_t start = stats_.Now();
         crc_.Init();
-        return Reset();
+        Result result = Reset();
+        stats_.InitDone(start);
+        return result;
     }
 
     Result Load(TData& data)
     {
-        if (active_block_n_ == -1)
+        uint32_t start = stats_.Now();
+        Result result = RESULT_FAIL_NO_DATA;
+
+        if (active_block_n_ != -1)
         {
-            return RESULT_FAIL_NO_DATA;
+            tracer_.Begin(TRACE_COPY, 0, sizeof(TData));
+            std::memcpy(&data, &block_.data, sizeof(TData));
+            tracer_.End(TRACE_COPY, true);
+            result = RESULT_SUCCESS;
         }
 
-        std::memcpy(&data, &block_.data, sizeof(TData));
-        return RESULT_SUCCESS;
+        stats_.LoadDone(start);
+        return result;
     }
 
     Result Save(const TData& data)
     {
-        if (DataIsSame(data))
+        uint32_t start = stats_.Now();
+        tracer_.Begin(TRACE_SAVE, 0, sizeof(TData));
+        stats_.SaveRequested();
+        Result result = WriteBlock(data);
+        tracer_.End(TRACE_SAVE, result == RESULT_SUCCESS);
+        stats_.SaveDone(start);
+        return result;
+    }
+
+    // Returns the statistics recorder. See inc/stats.h.
+    const auto& stats(void) const
+    {
+        return stats_;
+    }
+
+    Tracer& tracer(void)
+    {
+        return tracer_;
+    }
+
+    // Erases the whole region, using the largest erase commands available.
+    // This may be used to prepare memory in advance, e.g. when provisioning a
+    // device, so that the first saves need not erase. Any saved data is lost.
+    Result Format(void)
+    {
+        if (!EraseRange(0, kNumPages * kPageSize))
         {
-            return RESULT_SUCCESS;
+            Reset();
+            return RESULT_FAIL_ERASE;
         }
 
-        int32_t next_block = NextWritableBlock(active_block_n_);
-
-        if (next_block == -1)
+        for (uint32_t i = 0; i < kNumPages; i++)
         {
-            if (active_block_n_ == -1)
-            {
-                if (!nvmem_.Erase(0, kNumPages * kPageSize))
-                {
-                    return RESULT_FAIL_ERASE;
-                }
+            stats_.PageErased(i);
+        }
 
-                next_block = 0;
-                sequence_ = 0;
-            }
-            else
-            {
-                uint32_t current_page = active_block_n_ / kBlocksPerPage;
-                uint32_t next_page = (current_page + 1) % kNumPages;
+        active_block_n_ = -1;
+        sequence_ = 0;
+        ResetWriteState();
+        return RESULT_SUCCESS;
+    }
 
-                if (!nvmem_.Erase(next_page * kPageSize, kPageSize))
-                {
-                    return RESULT_FAIL_ERASE;
-                }
+    // Worst-case work performed by EmergencySave().
+    struct EmergencySaveCost
+    {
+        uint32_t erases;
+        uint32_t writes;
+        uint32_t bytes_written;
+        uint32_t bytes_copied;
+        uint32_t bytes_compared;
+        uint32_t bytes_crc;
+    };
 
-                next_block = next_page * kBlocksPerPage;
-                sequence_++;
-            }
+    // Prepares for EmergencySave() by reserving the next writable block,
+    // erasing a page if necessary. If the first `stable_size` bytes of the data
+    // passed to EmergencySave() will equal those of the currently saved data,
+    // their CRC is calculated here in advance. If they turn out to differ, the
+    // CRC of the whole data is calculated instead. While armed, each
+    // successful Save() re-arms automatically with the same `stable_size`.
+    Result Arm(uint32_t stable_size = 0)
+    {
+        armed_block_n_ = -1;
+        armed_requested_size_ = stable_size;
+
+        int32_t block_n;
+        TSequenceNum sequence;
+        Result result = FindNextBlock(block_n, sequence);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
         }
-        else
+
+        armed_stable_size_ = (active_block_n_ == -1) ? 0 :
+            std::min<uint32_t>(stable_size, sizeof(TData));
+        TCRC seed = datatype_version;
+        crc_.Seed(seed | (~seed << 8));
+        armed_crc_ = crc_.Process(&block_.data, armed_stable_size_);
+        armed_block_n_ = block_n;
+        armed_sequence_ = sequence;
+        return RESULT_SUCCESS;
+    }
+
+    bool armed(void) const
+    {
+        return armed_block_n_ != -1;
+    }
+
+    // Sequence number of the saved data, which changes whenever a save writes.
+    // Meaningless if no data has been saved.
+    auto sequence(void) const
+    {
+        return sequence_;
+    }
+
+    // Saves data to the armed block in bounded time, for use when power is
+    // failing. Performs no search or erase, and compares only the stable
+    // bytes; see GetEmergencySaveCost(). Disarms. Returns
+    // RESULT_FAIL_NOT_ARMED if Arm() has not succeeded since the last write.
+    Result EmergencySave(const TData& data)
+    {
+        if (armed_block_n_ == -1)
         {
-            sequence_++;
+            return RESULT_FAIL_NOT_ARMED;
         }
 
-        active_block_n_ = next_block;
-        uint32_t location = BlockLocation(active_block_n_);
+        int32_t previous_block_n = active_block_n_;
+        TSequenceNum previous_sequence = sequence_;
+        int32_t block_n = armed_block_n_;
+        armed_block_n_ = -1;
 
-        std::memcpy(&block_.data, &data, sizeof(TData));
-        std::memset(&block_.padding, NVMem::kFillByte, kBlockPaddingSize);
-        block_.sequence_n = sequence_;
-        block_.crc = GetCRC(block_);
+        // The precalculated CRC only holds if the stable bytes are unchanged.
+        uint32_t stable_size = armed_stable_size_;
 
-        if (!nvmem_.Write(location, &block_, kBlockSize))
+        if (0 != std::memcmp(&block_.data, &data, stable_size))
         {
-            Reset();
-            return RESULT_FAIL_WRITE;
+            stable_size = 0;
+            TCRC seed = datatype_version;
+            armed_crc_ = seed | (~seed << 8);
         }
 
-        return RESULT_SUCCESS;
+        Equality::Store(block_.data, data);
+        std::memset(&block_.padding, NVMem::kFillByte, kBlockPaddingSize);
+        block_.sequence_n = armed_sequence_;
+        crc_.Seed(armed_crc_);
+        block_.crc = crc_.Process(&block_.data[stable_size],
+            sizeof(TData) - stable_size + sizeof(TSequenceNum));
+
+        return ProgramBlock(block_n, armed_sequence_, previous_block_n,
+            previous_sequence);
+    }
+
+    // `bytes_crc` assumes that the stable bytes match; if they don't, the CRC
+    // covers as many bytes as with a `stable_size` of zero.
+    static constexpr EmergencySaveCost GetEmergencySaveCost(
+        uint32_t stable_size = 0)
+    {
+        stable_size = std::min<uint32_t>(stable_size, sizeof(TData));
+        return EmergencySaveCost{0, 1, kBlockSize, sizeof(TData), stable_size,
+            uint32_t(sizeof(TData) - stable_size + sizeof(TSequenceNum))};
+    }
+
+    // Program operations per save, as determined by the Layout and by
+    // NVMem::kProgramPageSize. See layout.h.
+    static constexpr ProgramCost GetProgramCost(void)
+    {
+        return CalculateProgramCost<NVMem, kBlockSize, Geometry>();
+    }
+
+    static constexpr LayoutReport GetLayoutReport(void)
+    {
+        return LayoutReport{kBlockSize, kPageSize, kBlocksPerPage, kNumBlocks,
+            kNumPages, kBlockPaddingSize,
+            kPageSize - kBlocksPerPage * kBlockSize,
+            NVMem::kSize - kNumPages * kPageSize,
+            float(kBlocksPerPage) * NVMem::kEraseGranularity / kPageSize,
+            kNumBlocks};
     }
 
     template <typename First, typename... Rest>
@@ -175,14 +298,16 @@ protected:
     };
 
     static constexpr uint32_t kBlockSize = sizeof(Block);
-    static constexpr uint32_t kPageSize =
-        kBlockSize + PadSize(kBlockSize, NVMem::kEraseGranularity);
-    static constexpr uint32_t kBlocksPerPage = kPageSize / kBlockSize;
+    using Geometry = typename Layout::template Geometry<NVMem, kBlockSize>;
+    static constexpr uint32_t kPageSize = Geometry::kPageSize;
+    static constexpr uint32_t kBlocksPerPage = Geometry::kBlocksPerPage;
     static constexpr uint32_t kNumBlocks = std::min<uint32_t>(
         (NVMem::kSize / kPageSize) * kBlocksPerPage,
         std::numeric_limits<TSequenceNum>::max() / 2 + 1);
     static constexpr uint32_t kNumPages =
         (kNumBlocks + kBlocksPerPage - 1) / kBlocksPerPage;
+    static constexpr uint32_t kSequenceWindow =
+        std::numeric_limits<TSequenceNum>::max() / 2 + 1;
 
     static_assert(kBlocksPerPage > 0);
     static_assert(kNumPages > 0);
@@ -190,45 +315,239 @@ protected:
     static_assert(assert_fault_tolerant == false || kNumPages >= 2,
         "Region is not fault-tolerant");
 
+    using StatsRecorder =
+        typename StatsPolicy::template Recorder<kNumPages>;
+
     NVMem& nvmem_;
     Block block_;
     int32_t active_block_n_;
+    // Block most recently written to, successfully or not. The search for a
+    // writable block starts after it.
+    int32_t head_block_n_;
+    int32_t armed_block_n_;
+    TSequenceNum armed_sequence_;
+    TCRC armed_crc_;
+    uint32_t armed_stable_size_;
+    // Stable size passed to Arm(), which may exceed armed_stable_size_ if
+    // there was no saved data to compare against.
+    uint32_t armed_requested_size_ = 0;
     TSequenceNum sequence_;
     Crc16 crc_;
+    StatsRecorder stats_ = {};
+    Tracer tracer_;
+
+    Result WriteBlock(const TData& data)
+    {
+        if (DataIsSame(data))
+        {
+            stats_.SaveSuppressed();
+            return RESULT_SUCCESS;
+        }
+
+        int32_t previous_block_n = active_block_n_;
+        TSequenceNum previous_sequence = sequence_;
+        int32_t block_n;
+        TSequenceNum sequence;
+        Result result = FindNextBlock(block_n, sequence);
+
+        if (result != RESULT_SUCCESS)
+        {
+            return result;
+        }
+
+        bool rearm = armed();
+        armed_block_n_ = -1;
+
+        tracer_.Begin(TRACE_COPY, 0, sizeof(TData));
+        Equality::Store(block_.data, data);
+        std::memset(&block_.padding, NVMem::kFillByte, kBlockPaddingSize);
+        tracer_.End(TRACE_COPY, true);
+        block_.sequence_n = sequence;
+        block_.crc = GetCRC(block_);
+
+        result = ProgramBlock(block_n, sequence, previous_block_n,
+            previous_sequence);
+
+        if (result == RESULT_SUCCESS && rearm)
+        {
+            Arm(armed_requested_size_);
+        }
+
+        return result;
+    }
+
+    // Finds the block to which the next save should be written, erasing a page
+    // if there is none, and the sequence number to write it with.
+    Result FindNextBlock(int32_t& block_n, TSequenceNum& sequence)
+    {
+        block_n = NextWritableBlock(head_block_n_);
+        sequence = sequence_ + 1;
+
+        if (block_n == -1)
+        {
+            if (active_block_n_ == -1)
+            {
+                // The region holds no valid blocks and none are writable.
+                // Erase only the first page; the others will be erased as
+                // the writes reach them.
+                if (!EraseRange(0, kPageSize))
+                {
+                    return RESULT_FAIL_ERASE;
+                }
+
+                stats_.PageErased(0);
+                block_n = 0;
+                sequence = 0;
+            }
+            else
+            {
+                uint32_t current_page = active_block_n_ / kBlocksPerPage;
+                uint32_t next_page = (current_page + 1) % kNumPages;
+                tracer_.Mark(TRACE_PAGE_ROLLOVER, next_page);
+
+                if (!EraseRange(next_page * kPageSize, kPageSize))
+                {
+                    return RESULT_FAIL_ERASE;
+                }
+
+                stats_.PageErased(next_page);
+                block_n = next_page * kBlocksPerPage;
+            }
+        }
+
+        return RESULT_SUCCESS;
+    }
+
+    // Writes block_, which must be complete, to `block_n`.
+    Result ProgramBlock(int32_t block_n, TSequenceNum sequence,
+        int32_t previous_block_n, TSequenceNum previous_sequence)
+    {
+        active_block_n_ = block_n;
+        head_block_n_ = block_n;
+        sequence_ = sequence;
+
+        if (!WriteMem(BlockLocation(block_n), &block_, kBlockSize))
+        {
+            RecoverFailedWrite(previous_block_n, previous_sequence);
+            return RESULT_FAIL_WRITE;
+        }
+
+        stats_.BlockWritten();
+        return RESULT_SUCCESS;
+    }
+
+    // Restores a consistent state after a failed write to the head block by
+    // re-reading only that block and the previously active block. The head
+    // block remains consumed, so the next save moves on to the next writable
+    // block. A full scan is only needed if the previously active block can no
+    // longer be verified.
+    void RecoverFailedWrite(int32_t previous_block_n,
+        TSequenceNum previous_sequence)
+    {
+        // The write may have completed despite reporting failure, in which
+        // case the block is now the newest and would be chosen by a remount.
+        if (ReadMem(&block_, BlockLocation(head_block_n_), kBlockSize) &&
+            block_.crc == GetCRC(block_))
+        {
+            return;
+        }
+
+        active_block_n_ = previous_block_n;
+        sequence_ = previous_sequence;
+
+        if (active_block_n_ != -1)
+        {
+            if (!ReadMem(&block_, BlockLocation(active_block_n_), kBlockSize) ||
+                block_.crc != GetCRC(block_) ||
+                block_.sequence_n != sequence_)
+            {
+                Reset();
+            }
+        }
+    }
 
     Result Reset(void)
     {
-        sequence_ = 0;
-        active_block_n_ = -1;
+        tracer_.Begin(TRACE_MOUNT, 0, kNumBlocks);
+        bool suspended = SuspendErase();
+        uint32_t crc_failures;
+        Result result = FindNewestBlock(0, kNumBlocks, block_, crc_,
+            active_block_n_, sequence_, crc_failures);
+        stats_.MountScanned(kNumBlocks, crc_failures);
+        ResetWriteState();
+
+        if (result == RESULT_SUCCESS)
+        {
+            result = ReadActiveBlock();
+        }
 
-        for (uint32_t i = 0; i < kNumBlocks; i++)
+        ResumeErase(suspended);
+        tracer_.End(TRACE_MOUNT, result == RESULT_SUCCESS);
+        return result;
+    }
+
+    // Scans blocks [first, last) for the most recently written valid block,
+    // using `block` and `crc` as scratch space. Sets `block_n` to -1 if none is
+    // found. If statistics or tracing are enabled, `crc_failures` counts the
+    // blocks which are neither valid nor blank.
+    Result FindNewestBlock(uint32_t first, uint32_t last, Block& block,
+        Crc16& crc, int32_t& block_n, TSequenceNum& sequence,
+        uint32_t& crc_failures)
+    {
+        sequence = 0;
+        block_n = -1;
+        crc_failures = 0;
+        tracer_.Begin(TRACE_SCAN, first, last - first);
+
+        for (uint32_t i = first; i < last; i++)
         {
             uint32_t location = BlockLocation(i);
 
-            if (!nvmem_.Read(&block_, location, kBlockSize))
+            if (!ReadMem(&block, location, kBlockSize))
             {
-                active_block_n_ = -1;
+                block_n = -1;
+                tracer_.End(TRACE_SCAN, false);
                 return RESULT_FAIL_READ;
             }
 
-            if (block_.crc == GetCRC(block_))
+            if (block.crc == GetCRC(block, crc))
             {
-                TSequenceNum sn = block_.sequence_n;
-                TSequenceNum delta = sn - sequence_;
+                TSequenceNum sn = block.sequence_n;
 
-                if (active_block_n_ == -1 || delta < kNumBlocks)
+                if (block_n == -1 || IsNewer(sn, sequence))
+                {
+                    block_n = i;
+                    sequence = sn;
+                }
+            }
+            else if constexpr (StatsRecorder::kEnabled || Tracer::kEnabled)
+            {
+                if (!IsBlank(block))
                 {
-                    active_block_n_ = i;
-                    sequence_ = sn;
+                    crc_failures++;
+                    tracer_.Mark(TRACE_CRC_MISMATCH, i);
                 }
             }
         }
 
+        tracer_.End(TRACE_SCAN, true);
+        return RESULT_SUCCESS;
+    }
+
+    // Must be called whenever active_block_n_ is determined by a scan.
+    void ResetWriteState(void)
+    {
+        head_block_n_ = active_block_n_;
+        armed_block_n_ = -1;
+    }
+
+    Result ReadActiveBlock(void)
+    {
         if (active_block_n_ != -1)
         {
             uint32_t location = BlockLocation(active_block_n_);
 
-            if (!nvmem_.Read(&block_, location, kBlockSize))
+            if (!ReadMem(&block_, location, kBlockSize))
             {
                 active_block_n_ = -1;
                 return RESULT_FAIL_READ;
@@ -238,18 +557,142 @@ protected:
         return RESULT_SUCCESS;
     }
 
+    bool ReadMem(void* dst, uint32_t location, uint32_t size)
+    {
+        tracer_.Begin(TRACE_READ, location, size);
+        bool suspended = SuspendErase();
+        bool success = nvmem_.Read(dst, location, size);
+        ResumeErase(suspended);
+        tracer_.End(TRACE_READ, success);
+        return success;
+    }
+
+    bool MemWritable(uint32_t location, uint32_t size)
+    {
+        tracer_.Begin(TRACE_WRITABLE, location, size);
+        bool suspended = SuspendErase();
+        bool writable = nvmem_.Writable(location, size);
+        ResumeErase(suspended);
+        tracer_.End(TRACE_WRITABLE, writable);
+        return writable;
+    }
+
+    // Reads need not wait for an erase in progress if NVMem can suspend it.
+    // The mount scan holds one suspension for all of its reads, during which
+    // the nested calls made by ReadMem() and MemWritable() return false.
+    bool SuspendErase(void)
+    {
+        if constexpr (HasEraseSuspend<NVMem>::value)
+        {
+            return nvmem_.SuspendErase();
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    void ResumeErase(bool suspended)
+    {
+        if constexpr (HasEraseSuspend<NVMem>::value)
+        {
+            if (suspended)
+            {
+                nvmem_.ResumeErase();
+            }
+        }
+    }
+
+    bool WriteMem(uint32_t location, const void* src, uint32_t size)
+    {
+        tracer_.Begin(TRACE_WRITE, location, size);
+        bool success = nvmem_.Write(location, src, size);
+        tracer_.End(TRACE_WRITE, success);
+        return success;
+    }
+
+    bool EraseMem(uint32_t location, uint32_t size)
+    {
+        tracer_.Begin(TRACE_ERASE, location, size);
+        bool success = nvmem_.Erase(location, size);
+        tracer_.End(TRACE_ERASE, success);
+        return success;
+    }
+
+    // Erases a range which is aligned to the erase granularity. If NVMem
+    // supports several erase sizes, the range is split into the fewest
+    // commands possible.
+    bool EraseRange(uint32_t location, uint32_t size)
+    {
+        if constexpr (HasEraseSizes<NVMem>::value)
+        {
+            while (size)
+            {
+                uint32_t command = NVMem::kEraseGranularity;
+
+                for (uint32_t s : NVMem::kEraseSizes)
+                {
+                    if (s <= size && location % s == 0)
+                    {
+                        command = std::max(command, s);
+                    }
+                }
+
+                if (!EraseMem(location, command))
+                {
+                    return false;
+                }
+
+                location += command;
+                size -= command;
+            }
+
+            return true;
+        }
+        else
+        {
+            return EraseMem(location, size);
+        }
+    }
+
+    static bool IsBlank(const Block& block)
+    {
+        auto byte = reinterpret_cast<const uint8_t*>(&block);
+        return std::all_of(byte, byte + kBlockSize,
+            [](uint8_t b) { return b == NVMem::kFillByte; });
+    }
+
+    // Persist keeps all valid blocks within kNumBlocks sequence numbers of
+    // each other, but comparisons hold across half the sequence space, so
+    // that pages may be reused out of order as long as no valid block falls
+    // further behind than that.
+    static bool IsNewer(TSequenceNum sn, TSequenceNum than)
+    {
+        TSequenceNum delta = sn - than;
+        return delta < kSequenceWindow;
+    }
+
     TCRC GetCRC(const Block& block)
     {
+        return GetCRC(block, crc_);
+    }
+
+    TCRC GetCRC(const Block& block, Crc16& crc)
+    {
+        constexpr uint32_t kSize = sizeof(TData) + sizeof(TSequenceNum);
+        tracer_.Begin(TRACE_CRC, 0, kSize);
         TCRC seed = datatype_version;
-        crc_.Seed(seed | (~seed << 8));
-        return crc_.Process(&block, sizeof(TData) + sizeof(TSequenceNum));
+        crc.Seed(seed | (~seed << 8));
+        TCRC result = crc.Process(&block, kSize);
+        tracer_.End(TRACE_CRC, true);
+        return result;
     }
 
     uint32_t BlockLocation(uint32_t block_n)
     {
         uint32_t page_n = block_n / kBlocksPerPage;
         block_n -= page_n * kBlocksPerPage;
-        return page_n * kPageSize + block_n * kBlockSize;
+        return page_n * kPageSize + Geometry::BlockOffset(block_n);
     }
 
     int32_t NextWritableBlock(int32_t current_block_n)
@@ -265,7 +708,7 @@ protected:
         {
             next_block_n = (next_block_n + 1) % kNumBlocks;
 
-            if (nvmem_.Writable(BlockLocation(next_block_n), kBlockSize))
+            if (MemWritable(BlockLocation(next_block_n), kBlockSize))
             {
                 break;
             }
@@ -277,11 +720,20 @@ protected:
 
     bool DataIsSame(const TData& data)
     {
-        return (active_block_n_ != -1) &&
-            (0 == std::memcmp(&block_.data, &data, sizeof(TData)));
+        if (active_block_n_ == -1)
+        {
+            return false;
+        }
+
+        tracer_.Begin(TRACE_COMPARE, 0, sizeof(TData));
+        bool same = Equality::Same(block_.data, data);
+        tracer_.End(TRACE_COMPARE, same);
+        return same;
     }
 
-    template <typename A, typename B, uint8_t C, bool D> friend class Persist;
+    template <typename A, typename B, uint8_t C, bool D, typename E, typename F,
+        typename G, typename H>
+    friend class Persist;
     using DataType = TData;
 
     template <typename... Ts, std::enable_if_t<sizeof...(Ts) == 0, bool> = true>